@@ -2,32 +2,190 @@
 #define ALIGN_PRIMERS_HPP
 
 #include "compare_aln_scores.hpp"
+#include "prepared_probe.hpp"
+#include "prepared_read.hpp"
 
 
 using namespace std;
 //typedef tuple <shared_ptr< MutableAlignment >,char> indexType;
-typedef tuple <shared_ptr< MutableAlignment >,char, set<int>> indexType;
+typedef tuple <shared_ptr< MutableAlignment >,char, set<int>, int> indexType;
+
+//////////////////////////////////////////////////////////////////////
+// best score a candidate probe can reach against the read, from the
+// length of the probe and the edits its seeds leave it with
+//////////////////////////////////////////////////////////////////////
+int candidate_score_bound(const alignment_parameters & aln_settings,
+			  const indexType & candidate){
+  return max_alignment_score(aln_settings, get<0>(candidate)->get_sequence().size(),
+			     get<3>(candidate));
+}
+
+//////////////////////////////////////////////////////////////////////
+// the order candidates are aligned in: highest bound first, that is
+// the probe with the most seed evidence for its length. Ties keep the
+// order of the index.
+//////////////////////////////////////////////////////////////////////
+vector<int> rank_candidates(const vector< indexType > & probes,
+			    const alignment_parameters & aln_settings,
+			    vector<int> & bounds){
+  bounds.resize(probes.size());
+  vector<int> order(probes.size());
+  for(int c = 0; c < probes.size(); ++c){
+    bounds[c] = candidate_score_bound(aln_settings, probes[c]);
+    order[c] = c;
+  }
+  stable_sort(order.begin(), order.end(), [&bounds](int a, int b){
+      return bounds[a] > bounds[b];
+    });
+  return order;
+}
+
+//////////////////////////////////////////////////////////////////////
+// true once max_report alignments score at least next_bound: no later
+// candidate can then enter the report, since the alignments are sorted
+// stably and ties go to the candidates aligned first
+//////////////////////////////////////////////////////////////////////
+bool report_is_final(const vector<alignment_report> & alignments,
+		     int max_report, int next_bound){
+  if(max_report <= 0 or alignments.size() < max_report){
+    return false;
+  }
+  vector<int> scores;
+  scores.reserve(alignments.size());
+  for(auto & alignment : alignments){
+    scores.push_back(alignment.aln_score);
+  }
+  nth_element(scores.begin(), scores.begin() + (max_report - 1), scores.end(), greater<int>());
+  return scores[max_report - 1] >= next_bound;
+}
+
+//////////////////////////////////////////////////////////////////////
+// the probe id and strand of every candidate
+//////////////////////////////////////////////////////////////////////
+set< pair<int, char> > candidate_strands(const ProbeSet & probe_set,
+					 const vector< indexType > & probes){
+  set< pair<int, char> > strands;
+  for(auto & candidate : probes){
+    strands.insert(make_pair(probe_set.id(get<0>(candidate)), get<1>(candidate)));
+  }
+  return strands;
+}
+
+//////////////////////////////////////////////////////////////////////
+// drop the candidates whose probe and strand already have an exact
+// match (see exact_matcher.hpp), aligning them would only find it again
+//////////////////////////////////////////////////////////////////////
+void drop_matched_candidates(const ProbeSet & probe_set,
+			     const set< pair<int, char> > & matched,
+			     vector< indexType > & probes){
+  if(matched.empty()){
+    return;
+  }
+  vector< indexType > remaining;
+  for(auto & candidate : probes){
+    if(matched.count(make_pair(probe_set.id(get<0>(candidate)), get<1>(candidate))) == 0){
+      remaining.push_back(candidate);
+    }
+  }
+  probes.swap(remaining);
+}
 
 void align_primers(input_parameters ip,
-		   SWAligner aligner,
+		   SWAligner & aligner,
 		   shared_ptr<MutableAlignment> read,
 		   vector< indexType > probes,
+		   const ProbeSet & probe_set,
 		   shared_ptr< vector<alignment_report> > alignments,
 		   int aln_len){
-  for(int i=0; i < probes.size(); ++i){
-    shared_ptr<MutableAlignment> probe = get<0>(probes[i]);
+  vector<int> bounds;
+  vector<int> order = rank_candidates(probes, ip.align_params, bounds);
+  for(int i : order){
+    if(report_is_final(*alignments, ip.max_report, bounds[i])){
+      break;
+    }
+    const PreparedProbe & probe = probe_set.find(get<0>(probes[i]));
     //convert char to string
     char strandC = get<1>(probes[i]);    
     string strand(1, strandC);
-    //aligner.align_strand(probe, read, ip.global_alignment,
-    //alignments, strand, aln_len);
-    aln_len = probe->get_sequence().size();
     aligner.align_strand(read, probe, ip.global_alignment,
-			 alignments, strand, aln_len);
+			 alignments, strand, get<2>(probes[i]));
 
   }
   if(alignments->size() > 0){
-    sort(alignments->begin(), alignments->end(), compare_aln_scores);
+    stable_sort(alignments->begin(), alignments->end(), compare_aln_scores);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// align a batch of reads against their candidate probes. Every round
+// aligns the next candidate of each read, in the order of
+// rank_candidates, and reads sharing a probe and strand in a round are
+// aligned together. A read drops out once its report is final. Each
+// read collects its alignments exactly as align_primers would have
+// produced them. The seed diagonals of each candidate are passed on to
+// the aligner.
+//////////////////////////////////////////////////////////////////////////
+void align_primers_batch(input_parameters ip,
+			 SWAligner & aligner,
+			 const vector< PreparedRead > & reads,
+			 const vector< vector< indexType > > & probes,
+			 const ProbeSet & probe_set,
+			 vector< shared_ptr< vector<alignment_report> > > & alignments){
+  vector< vector<int> > order(reads.size());
+  vector< vector<int> > bounds(reads.size());
+  for(int r = 0; r < reads.size(); ++r){
+    order[r] = rank_candidates(probes[r], ip.align_params, bounds[r]);
+  }
+  // (probe, strand) -> (read, candidate)
+  map< pair<int,char>, vector< pair<int,int> > > groups;
+  vector< shared_ptr< vector<alignment_report> > > results(reads.size());
+  vector< const PreparedRead * > group_reads;
+  vector< const set<int> * > group_diagonals;
+  vector< shared_ptr< vector<alignment_report> > > group_alignments;
+  for(int round = 0; ; ++round){
+    groups.clear();
+    for(int r = 0; r < reads.size(); ++r){
+      if(round >= order[r].size()){
+	continue;
+      }
+      int c = order[r][round];
+      if(report_is_final(*alignments[r], ip.max_report, bounds[r][c])){
+	continue;
+      }
+      int probe_id = probe_set.id(get<0>(probes[r][c]));
+      groups[make_pair(probe_id, get<1>(probes[r][c]))].push_back(make_pair(r, c));
+    }
+    if(groups.empty()){
+      break;
+    }
+    for(auto & group : groups){
+      const PreparedProbe & probe = probe_set.at(group.first.first);
+      string strand(1, group.first.second);
+      group_reads.clear();
+      group_diagonals.clear();
+      group_alignments.clear();
+      for(auto & member : group.second){
+	shared_ptr< vector<alignment_report> > member_alignments(new vector<alignment_report>());
+	results[member.first] = member_alignments;
+	group_reads.push_back(&reads[member.first]);
+	group_diagonals.push_back(&get<2>(probes[member.first][member.second]));
+	group_alignments.push_back(member_alignments);
+      }
+      aligner.align_batch(group_reads, group_diagonals, probe, ip.global_alignment,
+			  group_alignments, strand);
+    }
+    // a read aligns at most one candidate per round
+    for(auto & group : groups){
+      for(auto & member : group.second){
+	vector<alignment_report> & found = *results[member.first];
+	alignments[member.first]->insert(alignments[member.first]->end(), found.begin(), found.end());
+      }
+    }
+  }
+  for(int r = 0; r < reads.size(); ++r){
+    if(alignments[r]->size() > 0){
+      stable_sort(alignments[r]->begin(), alignments[r]->end(), compare_aln_scores);
+    }
   }
 }
 
@@ -1,6 +1,12 @@
 #ifndef ALIGNMENT_REPORT_HPP
 #define ALIGNMENT_REPORT_HPP
 
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "cigar.hpp"
+
 using namespace std;
 
 //alignment object check against
@@ -13,8 +19,8 @@ struct alignment_report {
   int query_start;
   int query_end;
   string strand;
-  string cigar_values;
-  string cigar;
+  // BAM encoded operations, see cigar.hpp
+  vector< uint32_t > cigar_ops;
   int aln_score;
   int edit_distance;
 };
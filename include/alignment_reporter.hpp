@@ -83,7 +83,7 @@ public:
 	+ aln.reference_name + "\t"		
 	+ to_string(aln.reference_start) + "\t"				
 	+ "0" + "\t"  // setting MapQ to zero for good alignment
-	+ aln.cigar + "\t"				
+	+ cigar_string(aln.cigar_ops) + "\t"				
 	+ "*" + "\t"  
 	+ "0" + "\t"  
 	+ "0" + "\t"  
@@ -0,0 +1,282 @@
+/**
+Scratch memory for SWAligner.
+
+One workspace lives as long as the aligner that owns it (one per thread) and
+is reused for every read, probe and strand. Buffers are contiguous and
+aligned to cache lines; they only grow when a longer read or probe arrives,
+so after the first few reads no alignment touches the allocator.
+*/
+#ifndef ALIGNMENT_WORKSPACE_HPP
+#define ALIGNMENT_WORKSPACE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+
+using namespace std;
+
+const size_t CACHE_LINE_SIZE = 64;
+
+///////////////////////////////////////////////////////////////////
+// growable cache aligned array, optionally keeping its contents
+///////////////////////////////////////////////////////////////////
+template <class T>
+class AlignedBuffer{
+
+  T * data_;
+  size_t capacity_;
+
+public:
+
+  AlignedBuffer(){
+    data_ = nullptr;
+    capacity_ = 0;
+  }
+
+  AlignedBuffer(const AlignedBuffer &) = delete;
+  AlignedBuffer & operator=(const AlignedBuffer &) = delete;
+
+  ~AlignedBuffer(){
+    free(data_);
+  }
+
+  T * reserve(size_t size, bool keep_contents = false){
+    if(size > capacity_){
+      // leave some room so slowly growing inputs do not reallocate every time
+      size_t new_capacity = max(size, capacity_ + capacity_ / 2);
+      void * memory = nullptr;
+      if(posix_memalign(&memory, CACHE_LINE_SIZE, new_capacity * sizeof(T)) != 0){
+	throw bad_alloc();
+      }
+      if(data_ != nullptr){
+	if(keep_contents){
+	  memcpy(memory, data_, capacity_ * sizeof(T));
+	}
+	free(data_);
+      }
+      data_ = static_cast<T *>(memory);
+      capacity_ = new_capacity;
+    }
+    return data_;
+  }
+
+  T * data(){
+    return data_;
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+};
+
+//////////////////////////////////////////////////////////////////////
+// traceback directions packed four cells to a byte: 0 match,
+// 1 insertion, 2 deletion and -1 mismatch, stored as 3
+//////////////////////////////////////////////////////////////////////
+class TracebackMatrix{
+
+  uint8_t ** rows_;
+
+public:
+
+  TracebackMatrix(){
+    rows_ = nullptr;
+  }
+
+  TracebackMatrix(uint8_t ** rows){
+    rows_ = rows;
+  }
+
+  int get(int row, int col) const {
+    int code = (rows_[row][col >> 2] >> ((col & 3) * 2)) & 3;
+    return ((code + 1) & 3) - 1;
+  }
+
+  void set(int row, int col, int trace){
+    uint8_t & cells = rows_[row][col >> 2];
+    int shift = (col & 3) * 2;
+    cells = (cells & ~(3 << shift)) | ((trace & 3) << shift);
+  }
+
+  uint8_t * row(int row){
+    return rows_[row];
+  }
+
+  // bytes used by a row of cols cells
+  static size_t row_bytes(int cols){
+    return (cols + 3) / 4;
+  }
+};
+
+/////////////////////////////////////////////////////////
+// per-thread matrices and arrays used by the aligner
+/////////////////////////////////////////////////////////
+class AlignmentWorkspace{
+
+  AlignedBuffer<int> scores_;
+  AlignedBuffer<uint8_t> traceback_;
+  AlignedBuffer<int> reference_maxima_;
+  AlignedBuffer<int> query_maxima_index_;
+  AlignedBuffer<int> window_maxima_;
+  AlignedBuffer<int> window_maxima_index_;
+  AlignedBuffer<int> window_maxima_source_;
+  AlignedBuffer<int> checkpoint_scores_;
+  AlignedBuffer<uint8_t> checkpoint_traceback_;
+  AlignedBuffer<char> kernel_;
+  AlignedBuffer<char> profile_;
+  vector<int *> score_rows_;
+  vector<uint8_t *> traceback_rows_;
+  vector<uint32_t> cigar_;
+
+  // pad rows to whole cache lines so every row starts aligned
+  size_t row_stride_(int cols){
+    size_t per_line = CACHE_LINE_SIZE / sizeof(int);
+    return ((cols + per_line - 1) / per_line) * per_line;
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // rows x cols matrix with a zeroed first row and first column, the
+  // remaining cells are left for the scoring pass to overwrite. With
+  // fewer physical rows than rows, row i shares memory with row
+  // i % physical_rows, which is all a scoring pass needs.
+  ////////////////////////////////////////////////////////////////////
+  int ** matrix_(AlignedBuffer<int> & buffer, vector<int *> & rows_index, int rows, int cols,
+		 int physical_rows){
+    size_t stride = row_stride_(cols);
+    physical_rows = min(rows, physical_rows);
+    int * cells = buffer.reserve(physical_rows * stride);
+    rows_index.resize(rows);
+    for(int i = 0; i < rows; ++i){
+      rows_index[i] = cells + (i % physical_rows) * stride;
+      rows_index[i][0] = 0;
+    }
+    fill(cells, cells + cols, 0);
+    return rows_index.data();
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // the same for traceback directions, a byte holds four cells
+  ////////////////////////////////////////////////////////////////////
+  TracebackMatrix packed_matrix_(int rows, int cols, int physical_rows){
+    size_t stride = ((cols + 4 * CACHE_LINE_SIZE - 1) / (4 * CACHE_LINE_SIZE)) * CACHE_LINE_SIZE;
+    physical_rows = min(rows, physical_rows);
+    uint8_t * cells = traceback_.reserve(physical_rows * stride);
+    traceback_rows_.resize(rows);
+    fill(cells, cells + TracebackMatrix::row_bytes(cols), 0);
+    for(int i = 0; i < rows; ++i){
+      traceback_rows_[i] = cells + (i % physical_rows) * stride;
+      traceback_rows_[i][0] &= ~3;
+    }
+    return TracebackMatrix(traceback_rows_.data());
+  }
+
+public:
+
+  AlignmentWorkspace(){}
+
+  int ** score_matrix(int rows, int cols){
+    return matrix_(scores_, score_rows_, rows, cols, rows);
+  }
+
+  TracebackMatrix traceback_matrix(int rows, int cols){
+    return packed_matrix_(rows, cols, rows);
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // the same matrices backed by two rows, for score-only passes that
+  // never look further back than the previous row
+  ////////////////////////////////////////////////////////////////////
+  int ** rolling_score_matrix(int rows, int cols){
+    return matrix_(scores_, score_rows_, rows, cols, 2);
+  }
+
+  TracebackMatrix rolling_traceback_matrix(int rows, int cols){
+    return packed_matrix_(rows, cols, 2);
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // the same matrices backed by block_rows + 1 rows, enough for any
+  // block_rows consecutive rows and the row above them
+  ////////////////////////////////////////////////////////////////////
+  int ** blocked_score_matrix(int rows, int cols, int block_rows){
+    return matrix_(scores_, score_rows_, rows, cols, block_rows + 1);
+  }
+
+  TracebackMatrix blocked_traceback_matrix(int rows, int cols, int block_rows){
+    return packed_matrix_(rows, cols, block_rows + 1);
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // saved rows of the blocked matrices, count rows of cols cells
+  ////////////////////////////////////////////////////////////////////
+  int * checkpoint_scores(int count, int cols){
+    return checkpoint_scores_.reserve((size_t) count * cols);
+  }
+
+  uint8_t * checkpoint_traceback(int count, int cols){
+    return checkpoint_traceback_.reserve((size_t) count * TracebackMatrix::row_bytes(cols));
+  }
+
+  ////////////////////////////////////////////////////////////
+  // cigar operations of the alignment being traced, emptied
+  ////////////////////////////////////////////////////////////
+  vector<uint32_t> & cigar_buffer(){
+    cigar_.clear();
+    return cigar_;
+  }
+
+  int * reference_maxima(int size){
+    int * maxima = reference_maxima_.reserve(size);
+    fill(maxima, maxima + size, 0);
+    return maxima;
+  }
+
+  int * query_maxima_index(int size){
+    int * maxima_index = query_maxima_index_.reserve(size);
+    fill(maxima_index, maxima_index + size, 0);
+    return maxima_index;
+  }
+
+  ///////////////////////////////////////////////////////////////
+  // column maxima over several read windows, with the window each
+  // maximum was found in
+  ///////////////////////////////////////////////////////////////
+  int * window_maxima(int size){
+    int * maxima = window_maxima_.reserve(size);
+    fill(maxima, maxima + size, 0);
+    return maxima;
+  }
+
+  int * window_maxima_index(int size){
+    int * maxima_index = window_maxima_index_.reserve(size);
+    fill(maxima_index, maxima_index + size, 0);
+    return maxima_index;
+  }
+
+  int * window_maxima_source(int size){
+    int * source = window_maxima_source_.reserve(size);
+    fill(source, source + size, 0);
+    return source;
+  }
+
+  //////////////////////////////////////////////////
+  // uninitialized scratch for the striped kernel
+  //////////////////////////////////////////////////
+  template <class T>
+  T * kernel_buffer(size_t count){
+    return reinterpret_cast<T *>(kernel_.reserve(count * sizeof(T)));
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  // query profile rows, earlier rows survive when the buffer grows
+  ///////////////////////////////////////////////////////////////////
+  template <class T>
+  T * profile_buffer(size_t count){
+    return reinterpret_cast<T *>(profile_.reserve(count * sizeof(T), true));
+  }
+};
+
+#endif
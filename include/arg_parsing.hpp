@@ -2,6 +2,7 @@
 #define ARG_PARSING_HPP
 
 #include "input_parameters.hpp"
+#include "rolling_kmer.hpp"
 #include <tclap/CmdLine.h>
 #include <regex>
 
@@ -21,7 +22,94 @@ public:
     argv = argv_in;
   }
 
+  //////////////////////////////////////////////////////////////
+  // kmer size and mismatches from '<kmer size>[,<mismatches>]'
+  //////////////////////////////////////////////////////////////
+  void parse_kmer_args(const string & kmers){
+    // parsing digits with optional comma separation
+    regex pattern1("(\\d+)");
+    regex pattern2("(\\d+),(\\d+)");
+    if(regex_match(kmers, pattern1)){
+      ip.kmer_size = stoi(kmers);
+      ip.kmer_mismatches = 0;
+    } else if(regex_match(kmers, pattern2)){
+      size_t pos = kmers.find(",");
+      ip.kmer_size = stoi(kmers.substr(0, pos));
+      ip.kmer_mismatches = stoi(kmers.substr(pos + 1, kmers.size()));
+    } else{
+      cerr << "--kmer_args (-k) must be of the format '(\\d+)' or '(\\d+),(\\d+)' for example: '12' or '12,1'" << endl;
+      // incorrect pattern
+      exit(1);
+    }
+    if(ip.kmer_size > MAX_KMER_SIZE){
+      cerr << "--kmer_args (-k) kmer size can be at most " << MAX_KMER_SIZE << endl;
+      exit(1);
+    }
+    if(ip.kmer_mismatches > MAX_KMER_MISMATCHES){
+      cerr << "--kmer_args (-k) mismatches can be at most " << MAX_KMER_MISMATCHES << endl;
+      exit(1);
+    }
+  }
+
+  //////////////////////////////////////////////////////////////
+  // minimizer window, 1 to MAX_MINIMIZER_WINDOW kmers
+  //////////////////////////////////////////////////////////////
+  void parse_window(int window){
+    if(window < 1 or window > MAX_MINIMIZER_WINDOW){
+      cerr << "--window (-w) must be from 1 to " << MAX_MINIMIZER_WINDOW << endl;
+      exit(1);
+    }
+    ip.kmer_window = window;
+  }
+
+  //////////////////////////////////////////////////////////////
+  // 'swifr index': save the query seqs and their kmer index
+  //////////////////////////////////////////////////////////////
+  input_parameters parse_index_arguments() {
+    try {
+      TCLAP::CmdLine cmd("Save the query sequences and their kmer index to <output>.idx, for swifr -i", ' ', "0.1");
+
+      TCLAP::ValueArg<string> outputArg("o", "output", "specify an output file basename", false, "index", "index");
+      cmd.add( outputArg );
+
+      TCLAP::ValueArg<int> windowArg("w", "window", "Minimizer Window: index only the kmer with the smallest hash of every window of this many consecutive kmers. 1 uses every kmer, at most 256 (default 1)", false, 1, "int");
+      cmd.add( windowArg );
+
+      TCLAP::SwitchArg canonicalArg("C", "canonical", "Canonical Kmers: index each kmer once under the smaller of it and its reverse complement, about halving the index", cmd, false);
+
+      TCLAP::ValueArg<string> kmerArg("k", "kmer_args", "Kmer size of the index, < kmer size >,< mismatches > also indexes the kmers that many mismatches away (at most 2, recommend at most 1)", true, "0", "int[,int]");
+      cmd.add( kmerArg );
+
+      TCLAP::ValueArg<int> nThreads("p", "processors", "The number of processors to build the index on (default = 1)", false, 1, "int");
+      cmd.add( nThreads );
+
+      TCLAP::ValueArg<string> QueryArg("q", "query", "fasta file with query sequence(s) to be indexed", true, "missing", "query.fasta");
+      cmd.add( QueryArg );
+
+      // the subcommand is not an argument
+      cmd.parse( argc - 1, argv + 1 );
+
+      parse_kmer_args(kmerArg.getValue());
+      if(ip.kmer_size < 1){
+	cerr << "--kmer_args (-k) kmer size must be at least 1 for an index" << endl;
+	exit(1);
+      }
+      ip.build_index = true;
+      ip.query_path = QueryArg.getValue();
+      ip.output_basename = outputArg.getValue();
+      parse_window(windowArg.getValue());
+      ip.n_threads = nThreads.getValue();
+      ip.kmer_canonical = canonicalArg.getValue();
+      return ip;
+    }
+    catch (TCLAP::ArgException &e)  // catch any exceptions
+      { cerr << "error: " << e.error() << " for arg " << e.argId() << endl; exit(1); }
+  }
+
   input_parameters parse_arguments() {
+    if(argc > 1 and string(argv[1]) == "index"){
+      return parse_index_arguments();
+    }
     try {
       //cmd with a help message for the bottom of the screen
       TCLAP::CmdLine cmd("", ' ', "0.1");
@@ -43,6 +131,25 @@ public:
       //add an argument for bam file
       TCLAP::SwitchArg globalArg("g", "global", "Score the adapter sequence end-to-end, allows negative integers in score matrix.", cmd, false);
       
+      //restrict alignments to the read around kmer seeds
+      TCLAP::ValueArg<int> bandArg("b", "band", "Band Width: with kmer filtering (-k), local alignments only cover the read around the kmer seeds of a query, padded by this many bases on each side. A negative value aligns against the whole read (default 32)", false, 32, "int");
+      cmd.add( bandArg );
+
+      //keep long read tracebacks in checkpointed rows
+      TCLAP::ValueArg<long> traceArg("t", "trace_cells", "Traceback Cells: alignments whose traceback covers more matrix cells than this are traced from checkpointed rows, using memory close to linear in the read length (default 33554432)", false, 33554432, "long");
+      cmd.add( traceArg );
+
+      //stop seed windows once the alignment has dropped off
+      TCLAP::ValueArg<int> xdropArg("x", "xdrop", "X-Drop: inside the seed windows of the kmer filter (-k, -b), stop scoring a window once a query has matched and the scores of a read position fall more than this below the best score of the window. A negative value scores whole windows (default -1)", false, -1, "int");
+      cmd.add( xdropArg );
+
+      //index only the minimizers of the query kmers
+      TCLAP::ValueArg<int> windowArg("w", "window", "Minimizer Window: with kmer filtering (-k), index and look up only the kmer with the smallest hash of every window of this many consecutive kmers, shrinking the index and the lookups per read about (w+1)/2 times. 1 uses every kmer, at most 256 (default 1)", false, 1, "int");
+      cmd.add( windowArg );
+
+      //index each kmer once for both strands
+      TCLAP::SwitchArg canonicalArg("C", "canonical", "Canonical Kmers: with kmer filtering (-k), index each query kmer once under the smaller of it and its reverse complement rather than once per strand, about halving the index. The query seqs found and their strands are unchanged", cmd, false);
+
       //run alignment on the ends of the reads
       TCLAP::ValueArg<int> nThreads("p", "processors", "The number of processors to use (default = 1)", false, 1, "int");
       cmd.add( nThreads );
@@ -66,20 +173,17 @@ public:
       //argument for handeling query index searches
       TCLAP::SwitchArg indexArg("c", "complete", "If no query seqs are returned by index, align read against all seqs", cmd, false);
 
-      /*
-      //add an argument for kmer, mismatch
-      TCLAP::ValueArg<string> kmerArg("k", "kmer_args", "Filter query by matching kmers with Read. By default, all query sequences are aligned to each read. Specifying the two integers < kmer size >, < mismatches> will set the size of kmers and total mismatches allowed (recommend 1)", false, "0,0", "int,int");
-      cmd.add( kmerArg );
-      */
-      
       //add an argument for kmer, mismatch
-      TCLAP::ValueArg<int> kmerArg("k", "kmer_args", "Filter query by matching kmers with Read. By default, all query sequences are aligned to each read. Specifying the kmer argument will filter the reference sequences by matching kmers ", false, 0, "int" );
+      TCLAP::ValueArg<string> kmerArg("k", "kmer_args", "Filter query by matching kmers with Read. By default, all query sequences are aligned to each read. Specifying < kmer size > filters the reference sequences by matching kmers, < kmer size >,< mismatches > also lets read kmers match with that many mismatches (at most 2, recommend at most 1)", false, "0", "int[,int]");
       cmd.add( kmerArg );
 
       
       //add an argument for fasta file
       TCLAP::ValueArg<string> QueryArg("q", "query", "fasta file with query sequence(s) to be aligned against the reads", true, "missing", "query.fasta");
-      cmd.add( QueryArg );
+
+      //or an index saved by 'swifr index'
+      TCLAP::ValueArg<string> indexFileArg("i", "index", "query sequences and their kmer index saved by 'swifr index', mapped instead of reading a query fasta and building the index. Its kmer size, mismatches and minimizer window replace -k, -w and -C", true, "missing", "index.idx");
+      cmd.xorAdd( QueryArg, indexFileArg );
       
       //add an argument for bam file
       TCLAP::ValueArg<string> readArg("f", "fastq", "fastq input file of read sequences. Query sequences are aligned in the forward orientation.", true, "missing", "reads.fastq");
@@ -89,29 +193,14 @@ public:
       cmd.parse( argc, argv );
 
       //kmer index parameter parsing
-      int kmer_size;
-      //int kmer_mismatches;
-
-      // parsing digits with comma separation
-      // regex pattern2("(\\d+),(\\d+)");
-      // string kmers = kmerArg.getValue();
-      // if(regex_match(kmers, pattern2)){
-      // 	size_t pos = kmers.find(",");
-      // 	kmer_size = stoi(kmers.substr(0, pos));
-      // 	kmer_mismatches = stoi(kmers.substr(pos + 1, kmers.size()));
-      // } else{
-      // 	cerr << "--kmer_args (-k) must be of the format '(\d+),(\d+)' for example: '12,1'" << endl;
-      // 	// incorrect pattern
-      // 	exit(1);
-      // }
+      parse_kmer_args(kmerArg.getValue());
       
       //fill the input parameters
       ip.verbose = verboseArg.getValue();
       ip.kmer_freq = freqArg.getValue();
-      ip.query_path = QueryArg.getValue();
+      ip.query_path = QueryArg.isSet() ? QueryArg.getValue() : "";
+      ip.index_path = indexFileArg.isSet() ? indexFileArg.getValue() : "";
       ip.complete_search = indexArg.getValue();
-      ip.kmer_size = kmerArg.getValue();
-      //ip.kmer_mismatches = kmer_mismatches;
       ip.max_report = reportArg.getValue();
       ip.read_path = readArg.getValue();
       ip.output_basename = outputArg.getValue();
@@ -122,6 +211,11 @@ public:
       ip.debug_mode = debugArg.getValue();
       ip.global_alignment = globalArg.getValue();
       ip.aln_len = alnPosArg.getValue();
+      ip.band_width = bandArg.getValue();
+      ip.trace_cells = traceArg.getValue();
+      ip.x_drop = xdropArg.getValue();
+      parse_window(windowArg.getValue());
+      ip.kmer_canonical = canonicalArg.getValue();
       //ip.output_file_type = typeArg.getValue();
       
       return ip;
@@ -0,0 +1,23 @@
+/**
+2-bit codes of the DNA bases, shared by the probe profiles, the exact
+matcher and the kmer index.
+*/
+#ifndef BASE_CODE_HPP
+#define BASE_CODE_HPP
+
+#include <cstdint>
+
+// A=0, C=1, G=2, T=3, anything else (N, IUPAC, lowercase) = 4
+const uint8_t BASE_CODE_OTHER = 4;
+
+inline uint8_t base_code(char base){
+  switch(base){
+  case 'A': return 0;
+  case 'C': return 1;
+  case 'G': return 2;
+  case 'T': return 3;
+  default: return BASE_CODE_OTHER;
+  }
+}
+
+#endif
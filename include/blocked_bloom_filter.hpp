@@ -0,0 +1,139 @@
+/**
+A Bloom filter over integer keys of up to 64 bits split into blocks of one
+cache line.
+
+Every key sets and tests its bits inside a single 512-bit block picked by
+its hash, so a lookup touches one cache line whatever the number of bits
+per key. The kmer index keeps one over its kmer codes to turn away read
+kmers that are in no probe before searching its postings.
+*/
+#ifndef BLOCKED_BLOOM_FILTER_HPP
+#define BLOCKED_BLOOM_FILTER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+#include "shared_array.hpp"
+
+using namespace std;
+
+class BlockedBloomFilter{
+
+public:
+
+  static const int WORDS_PER_BLOCK = 8;
+
+private:
+
+  static const int BITS_PER_KEY = 12;
+  static const int BITS_SET = 8;
+
+  SharedArray< uint64_t > blocks_;
+  uint64_t n_blocks_;
+
+  static uint64_t hash_(uint64_t key){
+    uint64_t h = key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // block from the high hash word, bits from the two halves of the low
+  uint64_t block_offset_(uint64_t h) const {
+    return ((h >> 32) * n_blocks_ >> 32) * WORDS_PER_BLOCK;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // the keys in [first, last) with a block offset in
+  // [block_first, block_last)
+  ////////////////////////////////////////////////////////////////
+  template <class Iterator>
+  void insert_(Iterator first, Iterator last, uint64_t block_first, uint64_t block_last,
+	       vector< uint64_t > & blocks) const {
+    for(; first != last; ++first){
+      uint64_t h = hash_(*first);
+      uint64_t offset = block_offset_(h);
+      if(offset < block_first or offset >= block_last){
+	continue;
+      }
+      uint64_t * block = blocks.data() + offset;
+      uint32_t h1 = h & 0xffff;
+      uint32_t h2 = ((h >> 16) & 0xffff) | 1;
+      for(int i = 0; i < BITS_SET; ++i){
+	uint32_t bit = (h1 + i * h2) & 511;
+	block[bit / 64] |= uint64_t(1) << (bit % 64);
+      }
+    }
+  }
+
+public:
+
+  BlockedBloomFilter(){
+    n_blocks_ = 0;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // the keys in [first, last), at about 0.5% false positives. With
+  // threads > 1 every thread hashes all keys but sets the bits of
+  // its own run of blocks only.
+  ////////////////////////////////////////////////////////////////
+  template <class Iterator>
+  BlockedBloomFilter(Iterator first, Iterator last, int threads = 1){
+    n_blocks_ = max< uint64_t >(1, (uint64_t(distance(first, last)) * BITS_PER_KEY + 511) / 512);
+    vector< uint64_t > blocks(n_blocks_ * WORDS_PER_BLOCK, 0);
+    threads = max< uint64_t >(1, min< uint64_t >(threads, n_blocks_));
+    vector< thread > workers;
+    for(int t = 1; t < threads; ++t){
+      workers.push_back(thread([&, t](){
+	    insert_(first, last, n_blocks_ * t / threads * WORDS_PER_BLOCK,
+		    n_blocks_ * (t + 1) / threads * WORDS_PER_BLOCK, blocks);
+	  }));
+    }
+    insert_(first, last, 0, n_blocks_ / threads * WORDS_PER_BLOCK, blocks);
+    for(auto & worker : workers){
+      worker.join();
+    }
+    blocks_ = SharedArray< uint64_t >(blocks);
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // a filter saved from blocks(), WORDS_PER_BLOCK words a block
+  ////////////////////////////////////////////////////////////////
+  BlockedBloomFilter(SharedArray< uint64_t > blocks){
+    blocks_ = blocks;
+    n_blocks_ = blocks_.size() / WORDS_PER_BLOCK;
+  }
+
+  const SharedArray< uint64_t > & blocks() const {
+    return blocks_;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // false only for keys never inserted, an empty filter holds
+  // nothing
+  ////////////////////////////////////////////////////////////////
+  bool contains(uint64_t key) const {
+    if(n_blocks_ == 0){
+      return false;
+    }
+    uint64_t h = hash_(key);
+    const uint64_t * block = blocks_.data() + block_offset_(h);
+    uint32_t h1 = h & 0xffff;
+    uint32_t h2 = ((h >> 16) & 0xffff) | 1;
+    for(int i = 0; i < BITS_SET; ++i){
+      uint32_t bit = (h1 + i * h2) & 511;
+      if(!(block[bit / 64] & (uint64_t(1) << (bit % 64)))){
+	return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
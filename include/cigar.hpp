@@ -0,0 +1,91 @@
+/**
+CIGAR operations in the BAM encoding: one uint32_t per run, the run length
+in the upper 28 bits and the operation in the lower 4 (M=0, I=1, D=2, S=4,
+X=8). Alignments carry their cigar this way and it is only turned into
+text when it is written out.
+*/
+#ifndef CIGAR_HPP
+#define CIGAR_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+const uint32_t CIGAR_MATCH = 0;
+const uint32_t CIGAR_INSERTION = 1;
+const uint32_t CIGAR_DELETION = 2;
+const uint32_t CIGAR_SOFT_CLIP = 4;
+const uint32_t CIGAR_MISMATCH = 8;
+// letter of every operation code
+const char CIGAR_LETTERS[] = "MIDNSHP=XB";
+
+inline uint32_t cigar_op(uint32_t length, uint32_t operation){
+  return (length << 4) | operation;
+}
+
+inline uint32_t cigar_op_length(uint32_t op){
+  return op >> 4;
+}
+
+inline uint32_t cigar_op_type(uint32_t op){
+  return op & 0xf;
+}
+
+inline char cigar_op_letter(uint32_t op){
+  return CIGAR_LETTERS[cigar_op_type(op)];
+}
+
+////////////////////////////////////////////////////////////////
+// append length operations, extending the last run if it has
+// the same operation
+////////////////////////////////////////////////////////////////
+inline void push_cigar_op(vector< uint32_t > & cigar, uint32_t operation, uint32_t length = 1){
+  if(length == 0){
+    return;
+  }
+  if(!cigar.empty() and cigar_op_type(cigar.back()) == operation){
+    cigar.back() += length << 4;
+  }
+  else{
+    cigar.push_back(cigar_op(length, operation));
+  }
+}
+
+////////////////////////////////////////////////////////////////
+// soft clip bases before and after the aligned part of the read
+////////////////////////////////////////////////////////////////
+inline void add_soft_clips(vector< uint32_t > & cigar, uint32_t front, uint32_t back){
+  push_cigar_op(cigar, CIGAR_SOFT_CLIP, back);
+  if(front == 0){
+    return;
+  }
+  if(!cigar.empty() and cigar_op_type(cigar.front()) == CIGAR_SOFT_CLIP){
+    cigar.front() += front << 4;
+  }
+  else{
+    cigar.insert(cigar.begin(), cigar_op(front, CIGAR_SOFT_CLIP));
+  }
+}
+
+// run-length text, as in "4M1X2M1D4M"
+inline string cigar_string(const vector< uint32_t > & cigar){
+  string text;
+  for(auto op : cigar){
+    text += to_string(cigar_op_length(op));
+    text += cigar_op_letter(op);
+  }
+  return text;
+}
+
+// one letter per operation, as in "MMMMXMMD"
+inline string expanded_cigar(const vector< uint32_t > & cigar){
+  string text;
+  for(auto op : cigar){
+    text.append(cigar_op_length(op), cigar_op_letter(op));
+  }
+  return text;
+}
+
+#endif
@@ -3,7 +3,7 @@
 
 using namespace std;
 
-bool compare_aln_scores(alignment_report & aln1, alignment_report & aln2){
+bool compare_aln_scores(const alignment_report & aln1, const alignment_report & aln2){
   return aln1.aln_score > aln2.aln_score;
 }
 
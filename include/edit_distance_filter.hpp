@@ -0,0 +1,204 @@
+/**
+Bit-parallel approximate matching (Myers 1999, in Hyyro's formulation) used
+to reject read x probe pairs before they reach the Smith-Waterman aligner.
+
+The probe is the pattern and the read the text: the filter computes the
+smallest edit distance between the whole probe and any substring of the read
+(semi-global search) in O(read length * words) word operations, where a word
+holds 64 probe positions. Probes up to 64bp take the single word path, longer
+probes are split into blocks that hand their horizontal deltas down to the
+next block.
+
+max_edit_distance() turns the scoring parameters and the minimum alignment
+score into the largest edit distance a local alignment reaching that score
+can have, so a pair whose distance is larger can never be reported.
+max_alignment_score() is the same bound read the other way round, the best
+score an alignment with at least a given number of edits can reach.
+*/
+#ifndef EDIT_DISTANCE_FILTER_HPP
+#define EDIT_DISTANCE_FILTER_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+
+#include "alignment_parameters.hpp"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+// smallest score an edit takes off a perfect alignment of the probe:
+// every lost probe base costs at least one match, every mismatch a match
+// and the mismatch penalty, every gap base the cheapest gap penalty.
+// 0 when edits can be free, or even pay.
+//////////////////////////////////////////////////////////////////////////
+inline int edit_cost(const alignment_parameters & aln_settings){
+  int gap = min(min(-aln_settings.insertion_open, -aln_settings.insertion_extend),
+		min(-aln_settings.deletion_open, -aln_settings.deletion_extend));
+  if(aln_settings.match <= 0 or aln_settings.mismatch > 0 or gap <= 0){
+    return 0;
+  }
+  return min(aln_settings.match, gap);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// largest semi-global edit distance between a probe of probe_len bases
+// and the read that still allows a local alignment scoring at least
+// min_aln_score, the score budget above min_aln_score bounds the edits.
+// -1 when the score can not be reached, probe_len when no bound holds.
+//////////////////////////////////////////////////////////////////////////
+inline int max_edit_distance(const alignment_parameters & aln_settings, int probe_len){
+  if(aln_settings.min_aln_score <= 0){
+    return probe_len;
+  }
+  if(aln_settings.match <= 0){
+    return -1;
+  }
+  int cost = edit_cost(aln_settings);
+  if(cost == 0){
+    return probe_len;
+  }
+  int budget = probe_len * aln_settings.match - aln_settings.min_aln_score;
+  if(budget < 0){
+    return -1;
+  }
+  return min(probe_len, budget / cost);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// best score of an alignment of a probe of probe_len bases that needs at
+// least edits edits, the largest int when the score is not bounded
+//////////////////////////////////////////////////////////////////////////
+inline int max_alignment_score(const alignment_parameters & aln_settings, int probe_len, int edits){
+  if(aln_settings.match <= 0){
+    return 0;
+  }
+  int cost = edit_cost(aln_settings);
+  if(cost == 0){
+    return numeric_limits<int>::max();
+  }
+  return probe_len * aln_settings.match - min(edits, probe_len) * cost;
+}
+
+////////////////////////////////////////////////////////////////
+// match masks of a pattern, one set of words per symbol of it
+////////////////////////////////////////////////////////////////
+class BitPattern{
+
+  int length_;
+  int words_;
+  uint64_t last_bit_;
+  // symbol index of every byte, 0 for bytes not in the pattern
+  uint8_t symbols_[256];
+  vector< uint64_t > peq_;
+
+  ////////////////////////////////////////////////////////////////////
+  // one text column of a 64 row block, hin is the horizontal delta
+  // entering the block from above, the delta leaving it is returned
+  ////////////////////////////////////////////////////////////////////
+  static int advance_block_(uint64_t & pv, uint64_t & mv, uint64_t eq, int hin, uint64_t high_bit){
+    uint64_t xv = eq | mv;
+    if(hin < 0){
+      eq |= 1;
+    }
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    int hout = 0;
+    if(ph & high_bit){
+      hout = 1;
+    }
+    else if(mh & high_bit){
+      hout = -1;
+    }
+    ph <<= 1;
+    mh <<= 1;
+    if(hin < 0){
+      mh |= 1;
+    }
+    else if(hin > 0){
+      ph |= 1;
+    }
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+    return hout;
+  }
+
+public:
+
+  BitPattern(){
+    length_ = 0;
+    words_ = 0;
+    last_bit_ = 0;
+    fill(symbols_, symbols_ + 256, 0);
+  }
+
+  BitPattern(const string & pattern){
+    length_ = pattern.size();
+    words_ = max(1, (length_ + 63) / 64);
+    last_bit_ = uint64_t(1) << ((max(length_, 1) - 1) % 64);
+    fill(symbols_, symbols_ + 256, 0);
+    int symbols = 1;
+    for(int i = 0; i < length_; ++i){
+      unsigned char base = pattern[i];
+      if(symbols_[base] == 0){
+	symbols_[base] = symbols++;
+      }
+    }
+    peq_.assign(symbols * words_, 0);
+    for(int i = 0; i < length_; ++i){
+      unsigned char base = pattern[i];
+      peq_[symbols_[base] * words_ + i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+
+  int length() const {
+    return length_;
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // true if the pattern occurs in text with at most max_dist edits
+  //////////////////////////////////////////////////////////////////
+  bool matches(const string & text, int max_dist) const {
+    if(max_dist < 0){
+      return false;
+    }
+    if(max_dist >= length_){
+      return true;
+    }
+    int score = length_;
+    if(words_ == 1){
+      uint64_t pv = ~uint64_t(0);
+      uint64_t mv = 0;
+      for(int j = 0; j < text.size(); ++j){
+	uint64_t eq = peq_[symbols_[(unsigned char) text[j]]];
+	score += advance_block_(pv, mv, eq, 0, last_bit_);
+	if(score <= max_dist){
+	  return true;
+	}
+      }
+      return false;
+    }
+    vector< uint64_t > pv(words_, ~uint64_t(0));
+    vector< uint64_t > mv(words_, 0);
+    const uint64_t high_bit = uint64_t(1) << 63;
+    for(int j = 0; j < text.size(); ++j){
+      const uint64_t * eq = peq_.data() + symbols_[(unsigned char) text[j]] * words_;
+      // the first row of a semi-global search is all zeros
+      int carry = 0;
+      for(int b = 0; b < words_; ++b){
+	carry = advance_block_(pv[b], mv[b], eq[b], carry, b == words_ - 1 ? last_bit_ : high_bit);
+      }
+      score += carry;
+      if(score <= max_dist){
+	return true;
+      }
+    }
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,197 @@
+/**
+Exact matches of the probes in a read, found ahead of the Smith-Waterman
+aligner.
+
+An ExactMatcher is an Aho-Corasick automaton over the A/C/G/T probe
+sequences of a ProbeSet, built once at startup and shared read-only by every
+thread. A read strand is scanned in one pass over its bases; the first
+occurrence of a probe becomes the alignment_report the aligner would give
+it, the whole probe matched (edit distance 0) at its full score, with the
+rest of the read soft clipped. No other alignment of that probe and strand
+can outscore it, so the aligner has nothing left to find there. Other bases
+(N, IUPAC, lowercase) send the automaton back to its root, as no probe
+holding them is in it. Only the probes and strands the kmer index picked
+for the read are reported, as only they would have been aligned.
+*/
+#ifndef EXACT_MATCHER_HPP
+#define EXACT_MATCHER_HPP
+
+#include <vector>
+#include <string>
+#include <queue>
+#include <set>
+#include <utility>
+#include <cstdint>
+
+#include "alignment_parameters.hpp"
+#include "alignment_report.hpp"
+#include "base_code.hpp"
+#include "cigar.hpp"
+#include "edit_distance_filter.hpp"
+#include "prepared_probe.hpp"
+#include "prepared_read.hpp"
+
+using namespace std;
+
+class ExactMatcher{
+
+  // automaton node: the state after each base, the longest proper
+  // suffix that is also a node, the probes ending here and the next
+  // node down the suffix chain that has probes ending at it
+  struct node{
+    int next[4];
+    int fail;
+    int output_link;
+    vector< int > probe_ids;
+  };
+
+  vector< node > nodes_;
+  vector< int > probe_lengths_;
+  vector< string > probe_names_;
+  int match_;
+  bool enabled_;
+
+  int add_node_(){
+    node fresh;
+    fill(fresh.next, fresh.next + 4, -1);
+    fresh.fail = 0;
+    fresh.output_link = -1;
+    nodes_.push_back(fresh);
+    return nodes_.size() - 1;
+  }
+
+  void add_probe_(const string & sequence, int probe_id){
+    int state = 0;
+    for(char base : sequence){
+      int code = base_code(base);
+      if(nodes_[state].next[code] < 0){
+	int child = add_node_();
+	nodes_[state].next[code] = child;
+      }
+      state = nodes_[state].next[code];
+    }
+    nodes_[state].probe_ids.push_back(probe_id);
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // breadth first over the trie: suffix links, output links, and the
+  // missing transitions filled in so the scan never follows a link
+  //////////////////////////////////////////////////////////////////
+  void link_nodes_(){
+    queue< int > pending;
+    for(int code = 0; code < 4; ++code){
+      int child = nodes_[0].next[code];
+      if(child < 0){
+	nodes_[0].next[code] = 0;
+      }
+      else{
+	pending.push(child);
+      }
+    }
+    while(!pending.empty()){
+      int state = pending.front();
+      pending.pop();
+      int fail = nodes_[state].fail;
+      nodes_[state].output_link = nodes_[fail].probe_ids.empty() ? nodes_[fail].output_link : fail;
+      for(int code = 0; code < 4; ++code){
+	int child = nodes_[state].next[code];
+	if(child < 0){
+	  nodes_[state].next[code] = nodes_[fail].next[code];
+	}
+	else{
+	  nodes_[child].fail = nodes_[fail].next[code];
+	  pending.push(child);
+	}
+      }
+    }
+  }
+
+  static bool is_acgt_(const string & sequence){
+    for(char base : sequence){
+      if(base_code(base) == BASE_CODE_OTHER){
+	return false;
+      }
+    }
+    return true;
+  }
+
+  void report_(const string & read_name, const string & read_sequence, const string & strand,
+	       int probe_id, int end, vector< alignment_report > & hits) const {
+    int length = probe_lengths_[probe_id];
+    alignment_report hit;
+    hit.query_name = read_name;
+    hit.reference_name = probe_names_[probe_id];
+    hit.reference_length = length;
+    hit.reference_start = 1;
+    hit.reference_end = length;
+    hit.query_start = end - length + 1;
+    hit.query_end = end;
+    hit.strand = strand;
+    push_cigar_op(hit.cigar_ops, CIGAR_MATCH, length);
+    add_soft_clips(hit.cigar_ops, end - length, read_sequence.size() - end);
+    hit.aln_score = length * match_;
+    hit.edit_distance = 0;
+    hits.push_back(hit);
+  }
+
+public:
+
+  ////////////////////////////////////////////////////////////////
+  // the automaton is left empty for scores where a whole matched
+  // probe is not the best alignment there is, and probes too short
+  // for the minimum score are left out of it
+  ////////////////////////////////////////////////////////////////
+  ExactMatcher(const ProbeSet & probes, alignment_parameters aln_settings){
+    match_ = aln_settings.match;
+    enabled_ = edit_cost(aln_settings) > 0;
+    add_node_();
+    for(int i = 0; i < probes.size(); ++i){
+      const string & sequence = probes.at(i).sequence();
+      probe_lengths_.push_back(sequence.size());
+      probe_names_.push_back(probes.at(i).name());
+      if(enabled_ and !sequence.empty() and is_acgt_(sequence)
+	 and (int) sequence.size() * match_ >= aln_settings.min_aln_score){
+	add_probe_(sequence, i);
+      }
+    }
+    link_nodes_();
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // append the exact match of every probe found in either strand of
+  // the read among candidates, by probe id and strand, and the probe id
+  // and strand of each to matched. Like the aligner, which keeps the
+  // first of equally scoring rows, only the occurrence ending first on
+  // a strand is reported.
+  //////////////////////////////////////////////////////////////////
+  void find_matches(const PreparedRead & read, const set< pair<int, char> > & candidates,
+		    vector< alignment_report > & hits, set< pair<int, char> > & matched) const {
+    if(nodes_.size() == 1 or candidates.empty()){
+      return;
+    }
+    for(string strand : {"+", "-"}){
+      const string & sequence = read.sequence(strand);
+      int state = 0;
+      for(int i = 0; i < sequence.size(); ++i){
+	int code = base_code(sequence[i]);
+	if(code == BASE_CODE_OTHER){
+	  state = 0;
+	  continue;
+	}
+	state = nodes_[state].next[code];
+	int found = nodes_[state].probe_ids.empty() ? nodes_[state].output_link : state;
+	while(found > 0){
+	  for(int probe_id : nodes_[found].probe_ids){
+	    pair<int, char> probe_strand = make_pair(probe_id, strand[0]);
+	    if(candidates.count(probe_strand) and matched.insert(probe_strand).second){
+	      report_(read.name(), sequence, strand, probe_id, i + 1, hits);
+	    }
+	  }
+	  found = nodes_[found].output_link;
+	}
+      }
+    }
+  }
+};
+
+#endif
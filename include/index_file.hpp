@@ -0,0 +1,297 @@
+/**
+The query seqs and their kmer index saved to a binary file by `swifr index`,
+so a run can map them instead of reading the fasta and building the index.
+
+The file is a fixed header followed by sections of raw arrays, each at a
+multiple of 8 bytes: the names and bases of the query seqs as string tables
+(one offset per seq plus one, then the characters) and the arrays of the
+KmerIndex as it holds them. A run maps the file read-only and points its
+KmerIndex straight at the sections, so swifr processes on one node mapping
+the same file share it in the page cache.
+
+The layout is that of the machine writing it; the version, byte order mark
+and sizes in the header turn away a file from a different one.
+*/
+#ifndef INDEX_FILE_HPP
+#define INDEX_FILE_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_lib_wrapper/mutable_alignment.hpp"
+#include "kmer_index.hpp"
+#include "shared_array.hpp"
+
+using namespace std;
+
+class IndexFile{
+
+  static const uint32_t VERSION = 3;
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+  enum section{
+    NAME_OFFSETS,
+    NAMES,
+    SEQUENCE_OFFSETS,
+    SEQUENCES,
+    KMER_COUNTS,
+    COVERED_OFFSETS,
+    KMER_KEYS,
+    KMER_OFFSETS,
+    POSTINGS,
+    FILTER_BLOCKS,
+    N_SECTIONS
+  };
+
+  struct file_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t posting_size;
+    int32_t kmer_size;
+    int32_t mismatches;
+    int32_t window;
+    int32_t canonical;
+    int32_t unused;
+    uint64_t n_seqs;
+    // byte offset and length of every section
+    uint64_t sections[N_SECTIONS][2];
+  };
+
+  // the mapped file, unmapped once the last array into it is gone
+  struct mapping{
+    void * data;
+    size_t size;
+
+    ~mapping(){
+      munmap(data, size);
+    }
+  };
+
+  string path_;
+  shared_ptr< const mapping > mapping_;
+  const file_header * header_;
+  vector< shared_ptr< MutableAlignment > > sequences_;
+
+  static const char * magic_(){
+    return "SWIFRIDX";
+  }
+
+  void fail_(const string & message) const {
+    cerr << "can not read index file " << path_ << ": " << message << endl;
+    exit(1);
+  }
+
+  template <class T>
+  SharedArray< T > section_(int id) const {
+    uint64_t offset = header_->sections[id][0];
+    uint64_t length = header_->sections[id][1];
+    if(offset % 8 != 0 or length % sizeof(T) != 0
+       or offset > mapping_->size or length > mapping_->size - offset){
+      fail_("the file is truncated or corrupt");
+    }
+    const T * data = reinterpret_cast< const T * >(static_cast< const char * >(mapping_->data) + offset);
+    return SharedArray< T >(mapping_, data, length / sizeof(T));
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // the strings of a string table, which must hold count of them
+  //////////////////////////////////////////////////////////////////
+  vector< string > strings_(int offsets_id, int chars_id, uint64_t count) const {
+    SharedArray< uint64_t > offsets = section_< uint64_t >(offsets_id);
+    SharedArray< char > chars = section_< char >(chars_id);
+    if(offsets.size() != count + 1 or offsets[0] != 0 or offsets.back() != chars.size()){
+      fail_("the file is truncated or corrupt");
+    }
+    vector< string > strings;
+    for(uint64_t i = 0; i < count; ++i){
+      if(offsets[i] > offsets[i + 1]){
+	fail_("the file is truncated or corrupt");
+      }
+      strings.push_back(string(chars.data() + offsets[i], offsets[i + 1] - offsets[i]));
+    }
+    return strings;
+  }
+
+  template <class T>
+  static void add_section_(vector< pair<const char *, uint64_t> > & sections, const T * data, uint64_t size){
+    sections.push_back(make_pair(reinterpret_cast< const char * >(data), size * sizeof(T)));
+  }
+
+public:
+
+  ////////////////////////////////////////////////////////////////
+  // maps the file at path, exits on files that are not an index
+  // written by this version
+  ////////////////////////////////////////////////////////////////
+  IndexFile(const string & path){
+    path_ = path;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+      fail_("the file can not be opened");
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 or file_stat.st_size < (off_t) sizeof(file_header)){
+      close(fd);
+      fail_("the file is too short to be an index");
+    }
+    void * data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+      fail_("the file can not be mapped");
+    }
+    mapping * mapped = new mapping();
+    mapped->data = data;
+    mapped->size = file_stat.st_size;
+    mapping_ = shared_ptr< const mapping >(mapped);
+    header_ = static_cast< const file_header * >(data);
+    if(memcmp(header_->magic, magic_(), 8) != 0){
+      fail_("the file is not a swifr index");
+    }
+    if(header_->version != VERSION or header_->byte_order != BYTE_ORDER_MARK
+       or header_->posting_size != sizeof(kmer_posting)){
+      fail_("the index was written by another version of swifr or on another platform, rebuild it with swifr index");
+    }
+    if(header_->kmer_size < 1 or header_->kmer_size > MAX_KMER_SIZE
+       or header_->mismatches < 0 or header_->mismatches > MAX_KMER_MISMATCHES
+       or header_->window < 1 or header_->window > MAX_MINIMIZER_WINDOW){
+      fail_("the file is truncated or corrupt");
+    }
+    vector< string > names = strings_(NAME_OFFSETS, NAMES, header_->n_seqs);
+    vector< string > bases = strings_(SEQUENCE_OFFSETS, SEQUENCES, header_->n_seqs);
+    for(uint64_t i = 0; i < header_->n_seqs; ++i){
+      sequences_.push_back(shared_ptr< MutableAlignment >(new MutableAlignment(names[i], bases[i])));
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // writes the query seqs and kmer index of index to path. The file
+  // is written next to path and renamed over it, so runs still
+  // mapping an older index at path keep reading that one.
+  //////////////////////////////////////////////////////////////////
+  static void write(const string & path, const KmerIndex & index){
+    const vector< shared_ptr< MutableAlignment > > & sequences = index.seq_univ_;
+    vector< uint64_t > name_offsets(1, 0);
+    vector< uint64_t > sequence_offsets(1, 0);
+    string names;
+    string bases;
+    for(auto & sequence : sequences){
+      names += sequence->get_read_id();
+      bases += sequence->get_sequence();
+      name_offsets.push_back(names.size());
+      sequence_offsets.push_back(bases.size());
+    }
+
+    file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic_(), 8);
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.posting_size = sizeof(kmer_posting);
+    header.kmer_size = index.kmer_size_;
+    header.mismatches = index.mismatches_;
+    header.window = index.window_;
+    header.canonical = index.canonical_;
+    header.n_seqs = sequences.size();
+
+    // in the order of the section ids
+    vector< pair<const char *, uint64_t> > sections;
+    add_section_(sections, name_offsets.data(), name_offsets.size());
+    add_section_(sections, names.data(), names.size());
+    add_section_(sections, sequence_offsets.data(), sequence_offsets.size());
+    add_section_(sections, bases.data(), bases.size());
+    add_section_(sections, index.kmer_counts_.data(), index.kmer_counts_.size());
+    add_section_(sections, index.covered_offsets_.data(), index.covered_offsets_.size());
+    // 64 bit keys for kmers too long for 32
+    if(index.kmer_size_ > MAX_NARROW_KMER_SIZE){
+      add_section_(sections, index.wide_kmer_keys_.data(), index.wide_kmer_keys_.size());
+    }
+    else{
+      add_section_(sections, index.kmer_keys_.data(), index.kmer_keys_.size());
+    }
+    add_section_(sections, index.kmer_offsets_.data(), index.kmer_offsets_.size());
+    add_section_(sections, index.postings_.data(), index.postings_.size());
+    add_section_(sections, index.filter_.blocks().data(), index.filter_.blocks().size());
+    uint64_t offset = sizeof(header);
+    for(int i = 0; i < N_SECTIONS; ++i){
+      offset = (offset + 7) / 8 * 8;
+      header.sections[i][0] = offset;
+      header.sections[i][1] = sections[i].second;
+      offset += sections[i].second;
+    }
+
+    string temp_path = path + ".tmp";
+    ofstream out(temp_path, ios::binary);
+    out.write(reinterpret_cast< const char * >(&header), sizeof(header));
+    const char padding[8] = {0};
+    uint64_t written = sizeof(header);
+    for(int i = 0; i < N_SECTIONS; ++i){
+      out.write(padding, header.sections[i][0] - written);
+      out.write(sections[i].first, sections[i].second);
+      written = header.sections[i][0] + sections[i].second;
+    }
+    out.close();
+    if(!out or rename(temp_path.c_str(), path.c_str()) != 0){
+      cerr << "can not write index file " << path << endl;
+      remove(temp_path.c_str());
+      exit(1);
+    }
+  }
+
+  const vector< shared_ptr< MutableAlignment > > & sequences() const {
+    return sequences_;
+  }
+
+  int kmer_size() const { return header_->kmer_size; }
+  int mismatches() const { return header_->mismatches; }
+  int window() const { return header_->window; }
+  bool canonical() const { return header_->canonical != 0; }
+
+  //////////////////////////////////////////////////////////////////
+  // the saved kmer index over sequences(), reading its arrays from
+  // the mapped file
+  //////////////////////////////////////////////////////////////////
+  shared_ptr< const KmerIndex > kmer_index(float kmer_freq) const {
+    shared_ptr< KmerIndex > index(new KmerIndex());
+    index->kmer_size_ = header_->kmer_size;
+    index->mismatches_ = header_->mismatches;
+    index->window_ = header_->window;
+    index->canonical_ = header_->canonical != 0;
+    index->kmer_freq_ = kmer_freq;
+    index->seq_univ_ = sequences_;
+    index->kmer_counts_ = section_< int32_t >(KMER_COUNTS);
+    index->covered_offsets_ = section_< int32_t >(COVERED_OFFSETS);
+    size_t n_keys = 0;
+    if(index->kmer_size_ > MAX_NARROW_KMER_SIZE){
+      index->wide_kmer_keys_ = section_< uint64_t >(KMER_KEYS);
+      n_keys = index->wide_kmer_keys_.size();
+    }
+    else{
+      index->kmer_keys_ = section_< uint32_t >(KMER_KEYS);
+      n_keys = index->kmer_keys_.size();
+    }
+    index->kmer_offsets_ = section_< uint32_t >(KMER_OFFSETS);
+    index->postings_ = section_< kmer_posting >(POSTINGS);
+    index->filter_ = BlockedBloomFilter(section_< uint64_t >(FILTER_BLOCKS));
+    if(index->kmer_counts_.size() != sequences_.size()
+       or index->covered_offsets_.size() != 2 * sequences_.size() + 1
+       or index->kmer_offsets_.size() != n_keys + 1
+       or index->kmer_offsets_.back() != index->postings_.size()){
+      fail_("the file is truncated or corrupt");
+    }
+    return index;
+  }
+};
+
+#endif
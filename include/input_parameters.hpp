@@ -10,6 +10,10 @@ using namespace std;
 struct input_parameters {
   string read_path;
   string query_path;
+  // saved query seqs and kmer index, read instead of query_path
+  string index_path;
+  // 'swifr index': save the index instead of aligning
+  bool build_index = false;
   int max_report = 5;
   string output_basename; 
   string output_file_type;
@@ -22,8 +26,13 @@ struct input_parameters {
   int n_reads = -1;
   int n_threads = 1;
   int aln_len = -1;
+  int band_width = 32;
+  long trace_cells = 33554432;
+  int x_drop = -1;
   int kmer_size;
-  int kmer_mismatches;
+  int kmer_mismatches = 0;
+  int kmer_window = 1;
+  bool kmer_canonical = false;
   float kmer_freq = 0.5;
   
 };
@@ -5,240 +5,660 @@
 #include <numeric>
 #include <math.h>
 #include <tuple>
+#include <limits>
+#include <cstdint>
+#include <thread>
 #include "unordered_map.hpp"
-#include "bloom_filter.hpp"
+#include "blocked_bloom_filter.hpp"
 #include "reverse_complement.hpp"
+#include "rolling_kmer.hpp"
+#include "shared_array.hpp"
 //#include <hopscotch_map.h>
-#include "bloom_filter.hpp"
 
-typedef tuple <string, char> countType;
-typedef tuple <shared_ptr< MutableAlignment >,char, set<int>> indexType;
+// query seq, strand, seed diagonals (kmer query positions in the index)
+// and the fewest edits an alignment of the query needs given its seeds
+typedef tuple <shared_ptr< MutableAlignment >,char, set<int>, int> indexType;
+
+//////////////////////////////////////////////////////////////////////
+// per-thread scratch for KmerIndex::filter_by_kmers, the index itself
+// stays read-only so one copy can be shared by every thread. Probe and
+// strand pairs are slots, 2 * probe id + 1 for '-'. The arrays span all
+// slots and stay allocated between reads; only the slots a read touched
+// are reset after it.
+//////////////////////////////////////////////////////////////////////
+class KmerSearchContext{
+
+  friend class KmerIndex;
+
+  // probe positions covered by matching kmers, counted and as bits
+  vector<int> coverage_;
+  vector<uint64_t> covered_;
+  // slots with coverage, in the order they were first hit
+  vector<int> touched_;
+  // slot and diagonal of every seed
+  vector< pair<int, int> > seeds_;
+  // read position and code of the kmers looked up, for the index's
+  // kmer size
+  vector< pair<int, uint32_t> > sampled_;
+  vector< pair<int, uint64_t> > wide_sampled_;
+
+  vector< pair<int, uint32_t> > & sampled_for_(uint32_t){ return sampled_; }
+  vector< pair<int, uint64_t> > & sampled_for_(uint64_t){ return wide_sampled_; }
+};
+
+//////////////////////////////////////////////////////////////////////
+// one indexed kmer: the probe it is in, the strand the probe aligns on
+// when the read holds the kmer (in a canonical index, when the read
+// kmer is the key itself rather than its reverse complement) and the
+// probe position it starts at.
+// With minimizers the kmer stands in for the unsampled kmers next to
+// it, the before kmers ahead of it and the after kmers behind it.
+//////////////////////////////////////////////////////////////////////
+struct kmer_posting{
+  uint32_t probe_id : 31;
+  uint32_t reverse : 1;
+  uint16_t position;
+  uint8_t before;
+  uint8_t after;
+};
+
+// last probe position a posting holds, the kmers of longer probes past
+// it are not indexed
+const int MAX_POSTING_POSITION = numeric_limits<uint16_t>::max();
+
+class IndexFile;
 
 class KmerIndex{
 
+  // saves and maps the arrays below
+  friend class IndexFile;
+
 private:
   int kmer_size_;
   int mismatches_;
   float kmer_freq_;
-  string dna_string_ = "ACGT";
+  // minimizer window, 1 indexes every kmer
+  int window_;
+  // kmers kept once under the smaller code of their two strands
+  bool canonical_;
   vector< shared_ptr< MutableAlignment > > seq_univ_;
   
-  ska::flat_hash_map<int, vector< indexType> >  seq_index_;
-
-  map<countType, int> query_sizes_;
-  map<countType, shared_ptr< MutableAlignment >> query_seqs_;
-  map<char, int> dna_vals_ {{'A', 0}, {'C', 1}, {'G', 2}, {'T', 3}};
+  // postings in compressed sparse rows, sorted by kmer: the postings
+  // of kmer_keys_[i] are postings_[kmer_offsets_[i] .. kmer_offsets_[i + 1]).
+  // Kmers longer than MAX_NARROW_KMER_SIZE keep their keys in
+  // wide_kmer_keys_ instead.
+  SharedArray< uint32_t > kmer_keys_;
+  SharedArray< uint64_t > wide_kmer_keys_;
+  SharedArray< uint32_t > kmer_offsets_;
+  SharedArray< kmer_posting > postings_;
+  // every key of kmer_keys_, to pass over read kmers in no probe
+  // without searching the keys
+  BlockedBloomFilter filter_;
+  // kmers in every probe, and where the coverage bits of each slot
+  // start in KmerSearchContext::covered_
+  SharedArray< int32_t > kmer_counts_;
+  SharedArray< int32_t > covered_offsets_;
     
-  void build_index_(){    
-    for(int i = 0; i < seq_univ_.size(); ++i){      
-      string seq = seq_univ_[i]->get_sequence();
-      string seqName = seq_univ_[i]->get_read_id();      
-      vector < string > kmers = kmerize_(seq);
-      // create keys to count kmers by reference
-      tuple<string, char> countForward = make_tuple(seqName, '+');
-      tuple<string, char> countReverse = make_tuple(seqName, '-');
-      /// count number of kmers in each reference, on each strand
-      query_sizes_[countForward] = kmers.size();
-      query_seqs_[countForward] = seq_univ_[i];
-      query_sizes_[countReverse] = kmers.size();
-      query_seqs_[countReverse] = seq_univ_[i];      
-      //vector < string > kmers2 = mismatch_kmers_(kmers);
-      int count = 0;     
-      for(auto &kmer : kmers){
-	int kmerInt = kmer_2_int_(kmer);
-	string seqName = seq_univ_[i]->get_read_id();
-	string kmerRc = reverse_complement(kmer);
-	int kmerRcInt = kmer_2_int_(kmerRc);
-	// store forward and reverse kmer in index
-	set<int> kmerRange;	
-	for(int Kidx = count; Kidx < (count + kmer_size_); ++Kidx){ 
-	  kmerRange.insert(Kidx);
-	}
-	tuple <shared_ptr<MutableAlignment>,char, set<int>> forward = make_tuple(seq_univ_[i], '+', kmerRange);
-	tuple <shared_ptr<MutableAlignment>,char, set<int>> reverse = make_tuple(seq_univ_[i], '-', kmerRange);
-	seq_index_[kmerInt].push_back(forward);
-	seq_index_[kmerRcInt].push_back(reverse);
-	count++;
+  // a kmer code and one of its postings, before they are sorted into rows
+  template <class Key>
+  using kmer_entry = pair<Key, kmer_posting>;
+
+  // the keys for Key codes, picked by the type of the argument
+  const SharedArray< uint32_t > & keys_(uint32_t) const { return kmer_keys_; }
+  const SharedArray< uint64_t > & keys_(uint64_t) const { return wide_kmer_keys_; }
+  void set_keys_(vector< uint32_t > & keys){ kmer_keys_ = SharedArray< uint32_t >(keys); }
+  void set_keys_(vector< uint64_t > & keys){ wide_kmer_keys_ = SharedArray< uint64_t >(keys); }
+
+  //////////////////////////////////////////////////////////////////////
+  // runs work(t) for every t in [0, threads), each on its own thread
+  // but the first, which runs on the caller's
+  //////////////////////////////////////////////////////////////////////
+  template <class Work>
+  static void run_threads_(int threads, Work work){
+    vector< thread > workers;
+    for(int t = 1; t < threads; ++t){
+      workers.push_back(thread(work, t));
+    }
+    work(0);
+    for(auto & worker : workers){
+      worker.join();
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // stable sort of entries by the lowest bits bits of their kmers, an
+  // LSD radix sort of 11 bits a pass
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  static void radix_sort_(kmer_entry<Key> * first, kmer_entry<Key> * last, int bits){
+    const int digit_bits = 11;
+    size_t n = last - first;
+    vector< kmer_entry<Key> > scratch(n);
+    kmer_entry<Key> * from = first;
+    kmer_entry<Key> * to = scratch.data();
+    vector< size_t > starts;
+    for(int low = 0; low < bits; low += digit_bits){
+      int width = min(digit_bits, bits - low);
+      Key mask = (Key(1) << width) - 1;
+      starts.assign((1 << width) + 1, 0);
+      for(size_t i = 0; i < n; ++i){
+	++starts[((from[i].first >> low) & mask) + 1];
       }
-    }    
+      partial_sum(starts.begin(), starts.end(), starts.begin());
+      for(size_t i = 0; i < n; ++i){
+	to[starts[(from[i].first >> low) & mask]++] = from[i];
+      }
+      swap(from, to);
+    }
+    if(from != first){
+      copy(from, from + n, first);
+    }
   }
 
-  void add_kmer_to_index(shared_ptr<MutableAlignment> refSeq, string kmer, char strand){
-    tuple <shared_ptr< MutableAlignment >,char> mapKey = make_tuple(refSeq, strand);    
+  //////////////////////////////////////////////////////////////////////
+  // the entries of the minimizers of probes [first, last) on both
+  // strands, all of their kmers for a window of 1, in probe order
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  void add_probes_(int first, int last, vector< kmer_entry<Key> > & entries){
+    BasicRollingKmer<Key> rolling(kmer_size_);
+    BasicMinimizerWindow<Key> forward_window(window_);
+    BasicMinimizerWindow<Key> reverse_window(window_);
+    vector< pair<int, Key> > forward_sampled;
+    vector< pair<int, Key> > reverse_sampled;
+    vector< bool > has_kmer;
+    for(int i = first; i < last; ++i){
+      const string & seq = seq_univ_[i]->get_sequence();
+      rolling.reset();
+      forward_window.reset();
+      reverse_window.reset();
+      forward_sampled.clear();
+      reverse_sampled.clear();
+      has_kmer.clear();
+      // the reverse kmers are sampled on their own, as a read holding
+      // the reverse complement of the probe samples them. Canonical
+      // kmers rank the same on both strands, so one window serves.
+      for(int pos = 0; pos < seq.size(); ++pos){
+	bool full = rolling.push(seq[pos]);
+	if(pos >= kmer_size_ - 1){
+	  has_kmer.push_back(full);
+	  if(canonical_){
+	    forward_window.push(full, rolling.forward(), min(rolling.forward(), rolling.reverse()),
+				forward_sampled);
+	  }
+	  else{
+	    forward_window.push(full, rolling.forward(), forward_sampled);
+	    reverse_window.push(full, rolling.reverse(), reverse_sampled);
+	  }
+	}
+      }
+      forward_window.finish(forward_sampled);
+      reverse_window.finish(reverse_sampled);
+      // store forward and reverse kmer in index, canonical kmers once
+      // for both
+      add_postings_(i, 0, forward_sampled, has_kmer, entries);
+      add_postings_(i, 1, reverse_sampled, has_kmer, entries);
+    }
   }
-    
-  int kmer_2_int_(string kmer){
-    //check out bit-wise operations
-    int val = 0;
-    for(int i = 0; i < kmer.size(); ++i){
-      int power = kmer.size() - i - 1;
-      char base = kmer[i];
-      if(power >0){
-	val = val + pow(4, power)*dna_vals_[base];
+
+  //////////////////////////////////////////////////////////////////////
+  // the rows of the index, built on threads threads. Each thread takes
+  // a run of probes and hands its entries out to buckets by the top
+  // bits of the kmer; each bucket, a range of kmers, is then sorted and
+  // cut into rows by one thread, and the buckets are joined in order.
+  // Entries reach their bucket in probe order and are radix sorted on
+  // the rest of their bits, which is stable, so the index is the same
+  // whatever the number of threads. Key is the type of the kmer codes.
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  void build_index_(int threads){
+    int n_seqs = seq_univ_.size();
+    threads = max(1, min(threads, n_seqs));
+    vector< int32_t > kmer_counts;
+    vector< int32_t > covered_offsets(1, 0);
+    for(int i = 0; i < n_seqs; ++i){
+      int length = seq_univ_[i]->get_sequence().size();
+      /// count number of kmers in each reference
+      int n_kmers = max(0, length - kmer_size_ + 1);
+      if(n_kmers > MAX_POSTING_POSITION + 1){
+	cerr << "query " << seq_univ_[i]->get_read_id() << " is longer than " << MAX_POSTING_POSITION + kmer_size_
+	     << " bases, only its first " << MAX_POSTING_POSITION + 1 << " kmers are indexed" << endl;
+	n_kmers = MAX_POSTING_POSITION + 1;
       }
-      else{
-	val = val +dna_vals_[base];
+      kmer_counts.push_back(n_kmers);
+      int words = (length + 63) / 64;
+      covered_offsets.push_back(covered_offsets.back() + words);
+      covered_offsets.push_back(covered_offsets.back() + words);
+    }
+
+    // a few buckets a thread, so uneven ones still share out well
+    int key_bits = 2 * kmer_size_;
+    int bucket_bits = 0;
+    while((1 << bucket_bits) < 4 * threads and bucket_bits < key_bits){
+      ++bucket_bits;
+    }
+    int n_buckets = 1 << bucket_bits;
+    int shift = key_bits - bucket_bits;
+    vector< vector< kmer_entry<Key> > > thread_entries(threads);
+    vector< vector< size_t > > bucket_sizes(threads, vector< size_t >(n_buckets, 0));
+    run_threads_(threads, [&](int t){
+	add_probes_((long) n_seqs * t / threads, (long) n_seqs * (t + 1) / threads, thread_entries[t]);
+	for(auto & entry : thread_entries[t]){
+	  ++bucket_sizes[t][entry.first >> shift];
+	}
+      });
+    // where the entries of every thread go in every bucket, the buckets
+    // in kmer order and the threads in probe order inside each
+    vector< size_t > bucket_starts(n_buckets + 1, 0);
+    vector< vector< size_t > > cursors(threads, vector< size_t >(n_buckets));
+    size_t n_entries = 0;
+    for(int b = 0; b < n_buckets; ++b){
+      bucket_starts[b] = n_entries;
+      for(int t = 0; t < threads; ++t){
+	cursors[t][b] = n_entries;
+	n_entries += bucket_sizes[t][b];
       }
     }
-    return val;
-  }
+    bucket_starts[n_buckets] = n_entries;
+    // the offsets into the postings are 32 bits
+    if(n_entries > numeric_limits<uint32_t>::max()){
+      cerr << "the kmer index has " << n_entries << " postings, more than " << numeric_limits<uint32_t>::max()
+	   << ", use fewer kmer mismatches or a minimizer window" << endl;
+      exit(1);
+    }
+    vector< kmer_entry<Key> > entries(n_entries);
+    run_threads_(threads, [&](int t){
+	for(auto & entry : thread_entries[t]){
+	  entries[cursors[t][entry.first >> shift]++] = entry;
+	}
+	vector< kmer_entry<Key> >().swap(thread_entries[t]);
+      });
 
-  vector< string > kmerize_(string sequence){
-    vector < string > kmers;
-    for(int k = 0; k < ( (sequence.size() - kmer_size_) +1); ++k){
-      string kmer = sequence.substr(k, kmer_size_);
-      // do not duplicate kmer information
-      //if(find(kmers.begin(), kmers.end(), kmer) == kmers.end()){
-	kmers.push_back(kmer);
-      //}
+    // rows of every bucket, offsets counted from the bucket start
+    vector< kmer_posting > postings(n_entries);
+    vector< vector< Key > > bucket_keys(n_buckets);
+    vector< vector< uint32_t > > bucket_offsets(n_buckets);
+    run_threads_(threads, [&](int t){
+	for(int b = t; b < n_buckets; b += threads){
+	  kmer_entry<Key> * first = entries.data() + bucket_starts[b];
+	  kmer_entry<Key> * last = entries.data() + bucket_starts[b + 1];
+	  radix_sort_(first, last, shift);
+	  vector< Key > & keys = bucket_keys[b];
+	  vector< uint32_t > & offsets = bucket_offsets[b];
+	  for(auto entry = first; entry != last; ++entry){
+	    if(keys.empty() or keys.back() != entry->first){
+	      keys.push_back(entry->first);
+	      offsets.push_back(entry - first);
+	    }
+	    postings[entry - entries.data()] = entry->second;
+	  }
+	}
+      });
+    vector< kmer_entry<Key> >().swap(entries);
+    vector< Key > kmer_keys;
+    vector< uint32_t > kmer_offsets;
+    for(int b = 0; b < n_buckets; ++b){
+      kmer_keys.insert(kmer_keys.end(), bucket_keys[b].begin(), bucket_keys[b].end());
+      for(uint32_t offset : bucket_offsets[b]){
+	kmer_offsets.push_back(bucket_starts[b] + offset);
+      }
     }
-    return kmers;
+    kmer_offsets.push_back(postings.size());
+    filter_ = BlockedBloomFilter(kmer_keys.begin(), kmer_keys.end(), threads);
+    set_keys_(kmer_keys);
+    kmer_offsets_ = SharedArray< uint32_t >(kmer_offsets);
+    postings_ = SharedArray< kmer_posting >(postings);
+    kmer_counts_ = SharedArray< int32_t >(kmer_counts);
+    covered_offsets_ = SharedArray< int32_t >(covered_offsets);
   }
 
-  vector< string > mismatch_kmers_(vector<string> kmers){
-    //add kmers of some edit distance away
-    vector < string > kmer_universe = kmers;
-    vector < string > mismatch_kmers;
-    // each iteration adds a new mismatch level
-    int iters = 0;
-    while(true){
-      ++iters;
-      if(iters > mismatches_){
+  //////////////////////////////////////////////////////////////////////
+  // postings of the sampled kmers of one probe strand. A sampled kmer
+  // stands in for the kmers back to the previous sampled one, and for
+  // those up to the end of the run of kmers when no sampled one
+  // follows in it. Probe positions past 65535 do not fit a posting and
+  // are not indexed.
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  void add_postings_(int probe_id, int reverse,
+		     const vector< pair<int, Key> > & sampled,
+		     const vector< bool > & has_kmer,
+		     vector< kmer_entry<Key> > & entries){
+    const int max_span = numeric_limits<uint8_t>::max();
+    for(int j = 0; j < sampled.size(); ++j){
+      int position = sampled[j].first;
+      if(position > MAX_POSTING_POSITION){
 	break;
       }
-      // for every kmer in our set, identify all possible 1nt snps
-      for(auto &kmer : kmer_universe){
-	add_mismatches_(kmer, mismatch_kmers);
+      int previous = j > 0 ? sampled[j - 1].first : -1;
+      int next = j + 1 < sampled.size() ? sampled[j + 1].first : has_kmer.size();
+      int first = position;
+      while(first - 1 > previous and has_kmer[first - 1] and position - first < max_span){
+	--first;
       }
-      // add mismatched kmers to universe
-      for(auto &mismatch_kmer : mismatch_kmers){
-	if(find(kmer_universe.begin(), kmer_universe.end(), mismatch_kmer) == kmer_universe.end()){
-	  kmer_universe.push_back(mismatch_kmer);
-	}
+      int last = position;
+      while(last + 1 < next and has_kmer[last + 1] and last - position < max_span){
+	++last;
       }
-      // if we loop again, 1nt errors will become 2nt errors, and so on
-      // this is definitely not an optimal solution
+      // the next sampled kmer covers the run up to it
+      if(j + 1 < sampled.size() and last + 1 == next){
+	last = position;
+      }
+      kmer_posting posting;
+      posting.probe_id = probe_id;
+      posting.reverse = reverse;
+      posting.position = position;
+      posting.before = position - first;
+      posting.after = last - position;
+      add_entry_(sampled[j].second, posting, entries);
+      add_neighbours_(sampled[j].second, posting, 0, mismatches_, entries);
     }
-    return kmer_universe;
   }
-			   
-  
-  void add_mismatches_(string ref_kmer, vector<string> & mismatch_kmers){
-    //for each kmer position
-    string mismatch_kmer = ref_kmer;
-    for(int k = 0; k < mismatch_kmer.size(); ++k){
-      //refresh kmer
-      mismatch_kmer = ref_kmer;
-      //add error for each position in the kmer
-      for(int n = 0; n < dna_string_.size(); ++n){
-	// can't match reference base
-	if(mismatch_kmer[k] == dna_string_[n]){
+
+  //////////////////////////////////////////////////////////////////////
+  // one entry, under the smaller of the kmer and its reverse complement
+  // for a canonical index; the posting's strand then flips with it
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  void add_entry_(Key kmer, kmer_posting posting, vector< kmer_entry<Key> > & entries){
+    if(canonical_){
+      Key reverse = reverse_complement_code(kmer, kmer_size_);
+      if(reverse < kmer){
+	kmer = reverse;
+	posting.reverse ^= 1;
+      }
+    }
+    entries.push_back(make_pair(kmer, posting));
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // the posting again for every kmer up to mismatches substitutions
+  // away from kmer, so a read kmer with that many errors still finds
+  // it. Each neighbour is made once: substitutions go at increasing
+  // kmer positions, from first_pos on, and never back to the original
+  // base.
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  void add_neighbours_(Key kmer, const kmer_posting & posting, int first_pos, int mismatches,
+		       vector< kmer_entry<Key> > & entries){
+    if(mismatches <= 0){
+      return;
+    }
+    for(int i = first_pos; i < kmer_size_; ++i){
+      int shift = 2 * (kmer_size_ - 1 - i);
+      Key original = (kmer >> shift) & 3;
+      for(Key base = 0; base < 4; ++base){
+	if(base == original){
 	  continue;
 	}
-	mismatch_kmer[k] = dna_string_[n];
-	// add kmer if it does not already exist
-	if(find(mismatch_kmers.begin(), mismatch_kmers.end(), mismatch_kmer) == mismatch_kmers.end()){
-	  mismatch_kmers.push_back(mismatch_kmer);
+	Key neighbour = (kmer & ~(Key(3) << shift)) | (base << shift);
+	add_entry_(neighbour, posting, entries);
+	add_neighbours_(neighbour, posting, i + 1, mismatches - 1, entries);
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // the postings of a kmer as a [first, last) range, empty if the
+  // kmer is not in any probe
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  pair<const kmer_posting *, const kmer_posting *> find_postings_(Key kmer) const {
+    const SharedArray< Key > & keys = keys_(kmer);
+    auto key = lower_bound(keys.begin(), keys.end(), kmer);
+    if(key == keys.end() or *key != kmer){
+      return make_pair(nullptr, nullptr);
+    }
+    int row = key - keys.begin();
+    return make_pair(postings_.data() + kmer_offsets_[row], postings_.data() + kmer_offsets_[row + 1]);
+  }
+
+  void add_kmer_to_index(shared_ptr<MutableAlignment> refSeq, string kmer, char strand){
+    tuple <shared_ptr< MutableAlignment >,char> mapKey = make_tuple(refSeq, strand);    
+  }
+    
+  template <class Key>
+  bool may_match_(const string & sequence) const {
+    BasicRollingKmer<Key> rolling(kmer_size_);
+    for(char base : sequence){
+      if(rolling.push(base)){
+	Key key = canonical_ ? min(rolling.forward(), rolling.reverse()) : rolling.forward();
+	if(filter_.contains(key)){
+	  return true;
+	}
+      }
+    }
+    return false;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // fewest edits an alignment of a query of query_len bases needs when
+  // only the covered positions are part of exactly matching kmers: every
+  // kmer sized stretch without cover holds an edit, or is not aligned.
+  // With minimizers only an exact stretch spanning a whole window of w
+  // kmers (w + k - 1 bases) is sure to hold a probe minimizer the read
+  // looks up, whether the read is sampled too or looked up at every
+  // kmer (mismatches > 0), so only stretches that long count. Queries
+  // with kmers past MAX_POSTING_POSITION, which are never covered, get
+  // no edits.
+  //////////////////////////////////////////////////////////////////////
+  int seed_edits_(int query_len, const uint64_t * covered) const {
+    if(query_len - kmer_size_ > MAX_POSTING_POSITION){
+      return 0;
+    }
+    int span = window_ + kmer_size_ - 1;
+    int edits = 0;
+    int last = -1;
+    for(int pos = 0; pos < query_len; ++pos){
+      if(covered[pos / 64] >> (pos % 64) & 1){
+	edits += (pos - last - 1) / span;
+	last = pos;
+      }
+    }
+    edits += (query_len - last - 1) / span;
+    return edits;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // the coverage and seeds of every slot from the sampled kmers of the
+  // read, Key being the type of the kmer codes, and the sums over the
+  // slots filter_by_kmers picks its cutoff from
+  //////////////////////////////////////////////////////////////////////
+  template <class Key>
+  void count_kmers_(const string & sequence, KmerSearchContext & context,
+		    double & total, double & sqSum, int & maxMatch) const {
+    int read_len = sequence.size();
+    vector<int> & coverage = context.coverage_;
+    vector<uint64_t> & covered = context.covered_;
+    vector<int> & touched = context.touched_;
+    vector< pair<int, int> > & seeds = context.seeds_;
+    vector< pair<int, Key> > & sampled = context.sampled_for_(Key());
+    sampled.clear();
+    //check index for kmers, returning all query seqs that match the kmers
+    //I need to keep track of the kmer that matches, in case of repeating kmers
+    BasicRollingKmer<Key> rolling(kmer_size_);
+    BasicMinimizerWindow<Key> window(mismatches_ > 0 ? 1 : window_);
+    for(int pos = 0; pos < read_len; ++pos){
+      bool full = rolling.push(sequence[pos]);
+      if(pos >= kmer_size_ - 1){
+	if(canonical_){
+	  window.push(full, rolling.forward(), min(rolling.forward(), rolling.reverse()), sampled);
+	}
+	else{
+	  window.push(full, rolling.forward(), sampled);
+	}
+      }
+    }
+    window.finish(sampled);
+    for(auto & kmer : sampled){
+      int read_pos = kmer.first;
+      Key key = kmer.second;
+      // a canonical posting is on the strand it was stored on when the
+      // read kmer was flipped the same way, on the other one if not. A
+      // kmer that is its own reverse complement is on both.
+      int flipped = 0;
+      int strands = 1;
+      if(canonical_){
+	Key reverse = reverse_complement_code(key, kmer_size_);
+	flipped = reverse < key;
+	strands = reverse == key ? 2 : 1;
+	key = min(key, reverse);
+      }
+      if(!filter_.contains(key)){
+	continue;
+      }
+      auto hit = find_postings_(key);
+      for(int strand = 0; strand < strands; ++strand)
+      for(const kmer_posting * x = hit.first; x != hit.second; ++x){
+	int reverse = x->reverse ^ flipped ^ strand;
+	int slot = 2 * x->probe_id + reverse;
+	uint64_t * bits = covered.data() + covered_offsets_[slot];
+	int & count = coverage[slot];
+	if(count == 0){
+	  touched.push_back(slot);
+	}
+	for(int idx = x->position - x->before; idx < x->position + x->after + kmer_size_; ++idx){
+	  uint64_t bit = uint64_t(1) << (idx % 64);
+	  if(!(bits[idx / 64] & bit)){
+	    bits[idx / 64] |= bit;
+	    sqSum += 2 * count + 1;
+	    total += 1;
+	    ++count;
+	  }
+	}
+	maxMatch = max(maxMatch, count);
+	// '-' seeds are aligned against the reverse complemented read
+	int query_pos = x->position;
+	if(!reverse){
+	  seeds.push_back(make_pair(slot, read_pos - query_pos));
+	}
+	else{
+	  seeds.push_back(make_pair(slot, read_len - read_pos - kmer_size_ - query_pos));
 	}
       }
     }
   }
-        
+
+  // filled in by IndexFile
+  KmerIndex(){
+  }
+
 public:
 
+  //////////////////////////////////////////////////////////////////////
+  // window > 1 indexes only the (window, kmer_size)-minimizers of the
+  // probes and looks up only those of the reads, each standing in for
+  // the kmers around it (see add_postings_) so coverage stays close to
+  // that of the full index. mismatches > 0 also indexes every kmer that
+  // many substitutions away from an indexed one; reads are then looked
+  // up at every kmer, as a kmer with an error is rarely a minimizer.
+  // kmer_size is at most MAX_KMER_SIZE. The index is built on threads
+  // threads. A canonical index keeps each probe kmer once, under the
+  // smaller code of its two strands, rather than once per strand, and
+  // finds the same query seqs on the same strands.
+  //////////////////////////////////////////////////////////////////////
   KmerIndex(vector< shared_ptr< MutableAlignment > > sequences,
 	    int kmer_size,
 	    int mismatches,
-	    float kmer_freq){
+	    float kmer_freq,
+	    int window = 1,
+	    int threads = 1,
+	    bool canonical = false){
     kmer_size_ = kmer_size;
     seq_univ_ = sequences;
-    mismatches_ = mismatches;
+    mismatches_ = max(mismatches, 0);
     kmer_freq_ = kmer_freq;
-    build_index_();
+    window_ = max(window, 1);
+    canonical_ = canonical;
+    if(kmer_size_ > MAX_NARROW_KMER_SIZE){
+      build_index_< uint64_t >(threads);
+    }
+    else{
+      build_index_< uint32_t >(threads);
+    }
   }  
   
-  vector< indexType > filter_by_kmers(string sequence,
-				      bool search_hard){
-    vector < string > subject_kmers = kmerize_(sequence);
-    
-    //map<countType, int> univ;
-    map<countType, set<int>> univ;    
+  //////////////////////////////////////////////////////////////////////
+  // query seqs sharing enough kmers with the read, each returned with
+  // the diagonals of its seeds: the read position (on the strand the
+  // query aligns to) minus the query position of every matching kmer.
+  // Safe to call from several threads, each with its own context.
+  //////////////////////////////////////////////////////////////////////
+  vector< indexType > filter_by_kmers(const string & sequence,
+				      bool search_hard,
+				      KmerSearchContext & context) const {
+    int slots = 2 * seq_univ_.size();
+    vector<int> & coverage = context.coverage_;
+    vector<uint64_t> & covered = context.covered_;
+    vector<int> & touched = context.touched_;
+    vector< pair<int, int> > & seeds = context.seeds_;
     vector< indexType > filt_query;
+    if(coverage.size() != slots){
+      coverage.assign(slots, 0);
+      covered.assign(covered_offsets_.back(), 0);
+    }
+    touched.clear();
+    seeds.clear();
     
-    map<countType, shared_ptr< MutableAlignment >>::iterator seqIter = query_seqs_.begin();
-
-    while(seqIter != query_seqs_.end()){
-      univ[seqIter->first] = set<int>(); 
-      seqIter++;
+    // coverage summed over all slots, untouched slots count as zeros
+    double total = 0.0;
+    double sqSum = 0.0;
+    int maxMatch = 0;
+    if(kmer_size_ > MAX_NARROW_KMER_SIZE){
+      count_kmers_< uint64_t >(sequence, context, total, sqSum, maxMatch);
     }
-    //check index for kmers, returning all query seqs that match the kmers
-    //I need to keep track of the kmer that matches, in case of repeating kmers
-    int tot = 0;
-    for(auto &kmer : subject_kmers){
-      //if(!filter_.contains(kmer)){
-      //continue;
-      //}
-      int kmerInt = kmer_2_int_(kmer);
-      tot++;
-      if(seq_index_.find(kmerInt) != seq_index_.end()){
-	for(auto &x : seq_index_[kmerInt]){
-	  string id = get<0>(x)->get_read_id();
-	  tuple<string, char> toCount = make_tuple(id, get<1>(x));
-	  //univ[toCount] = set_union(univ[toCount], get<2>(x));
-	  for(auto &idx : get<2>(x)){
-	    univ[toCount].insert(idx);
-	  }
-	  //univ[toCount]++;
-	}
-      }
+    else{
+      count_kmers_< uint32_t >(sequence, context, total, sqSum, maxMatch);
     }
     
-    // calculate average score by query seq
-    vector<int> matches;
-    map<countType, set<int>>::iterator iter = univ.begin();
-    float total = 0.0;
-    while(iter != univ.end()){
-      matches.push_back(iter->second.size());
-      iter++;
-    }
-
-    // find outliers, most likely hits
-    total = accumulate( matches.begin(), matches.end(), 0.0);
-    float avg = total/matches.size();
-    // standard deviation
-    double sqSum = std::inner_product(matches.begin(), matches.end(), matches.begin(), 0.0);
-    double stdev = sqrt(sqSum / matches.size() - avg * avg);
-    float cutoff1 = avg+(2*stdev);
-    int maxMatch = *max_element(matches.begin(), matches.end());    
-    //maxMatch - 1 std dev unit
-    float cutoff2 = maxMatch - (1*stdev);    
-    float cutoff = cutoff1;
-    if(cutoff2 > cutoff1){
-      cutoff = cutoff2;
-    }   
-    // choose query seqs to align, based off kmer identity
-    iter = univ.begin();
-    while(iter != univ.end()){
-      float total_kmers = query_sizes_[iter->first];      
-      if(iter->second.size() > cutoff){
-	//cerr << "cutoff " << cutoff << " size " << iter->second.size() << endl;
-	tuple <shared_ptr< MutableAlignment >,char, set<int>> seqStrand = make_tuple(query_seqs_[iter->first], get<1>(iter->first), set<int>());
-	filt_query.push_back(seqStrand);
-      }
-      else if((iter->second.size() / total_kmers)  > kmer_freq_){
-	//cerr << "fraction " << (iter->second.size() / total_kmers) << endl;
-	tuple <shared_ptr< MutableAlignment >,char, set<int>> seqStrand = make_tuple(query_seqs_[iter->first], get<1>(iter->first), set<int>());
-	filt_query.push_back(seqStrand);
+    if(slots > 0){
+      // find outliers, most likely hits
+      float avg = float(total)/slots;
+      // standard deviation
+      double stdev = sqrt(sqSum / slots - avg * avg);
+      float cutoff1 = avg+(2*stdev);
+      //maxMatch - 1 std dev unit
+      float cutoff2 = maxMatch - (1*stdev);    
+      float cutoff = cutoff1;
+      if(cutoff2 > cutoff1){
+	cutoff = cutoff2;
+      }   
+      // choose query seqs to align, based off kmer identity, in the
+      // order of the index
+      sort(touched.begin(), touched.end());
+      stable_sort(seeds.begin(), seeds.end(), [](const pair<int, int> & a, const pair<int, int> & b){
+	  return a.first < b.first;
+	});
+      auto seed = seeds.begin();
+      for(int slot : touched){
+	int probe_id = slot / 2;
+	float total_kmers = kmer_counts_[probe_id];
+	set<int> diagonals;
+	for(; seed != seeds.end() and seed->first == slot; ++seed){
+	  diagonals.insert(seed->second);
+	}
+	if(coverage[slot] > cutoff or (coverage[slot] / total_kmers) > kmer_freq_){
+	  //cerr << "cutoff " << cutoff << " size " << coverage[slot] << endl;
+	  shared_ptr< MutableAlignment > query = seq_univ_[probe_id];
+	  indexType seqStrand = make_tuple(query, slot % 2 ? '-' : '+', diagonals,
+					   seed_edits_(query->get_sequence().size(),
+						       covered.data() + covered_offsets_[slot]));
+	  filt_query.push_back(seqStrand);
+	}
       }
-      iter++;
+    }
+    // reset the touched slots for the next read
+    for(int slot : touched){
+      coverage[slot] = 0;
+      fill(covered.begin() + covered_offsets_[slot], covered.begin() + covered_offsets_[slot + 1], 0);
     }
     
     if(filt_query.size() == 0){
       vector<indexType> allSeqs;
       if(search_hard){	
 	for(int i = 0; i < seq_univ_.size(); ++i){      
-	  tuple<shared_ptr<MutableAlignment>, char, set<int>> forward = make_tuple(seq_univ_[i], '+', set<int>());
-	  tuple<shared_ptr<MutableAlignment>, char, set<int>> reverse = make_tuple(seq_univ_[i], '-', set<int>());
+	  indexType forward = make_tuple(seq_univ_[i], '+', set<int>(), 0);
+	  indexType reverse = make_tuple(seq_univ_[i], '-', set<int>(), 0);
 	  allSeqs.push_back(forward);
 	  allSeqs.push_back(reverse);
 	}	      
@@ -248,11 +668,29 @@ public:
     return filt_query;
   }
 
-  vector< indexType > all_seqs(){
+  //////////////////////////////////////////////////////////////////////
+  // false when no kmer of the read can be in the index, so that
+  // filter_by_kmers would find no query seqs for it. Every kmer is
+  // tested, whatever the window, and only against the bloom filter.
+  //////////////////////////////////////////////////////////////////////
+  bool may_match(const string & sequence) const {
+    if(kmer_size_ > MAX_NARROW_KMER_SIZE){
+      return may_match_< uint64_t >(sequence);
+    }
+    return may_match_< uint32_t >(sequence);
+  }
+
+  vector< indexType > filter_by_kmers(const string & sequence,
+				      bool search_hard) const {
+    KmerSearchContext context;
+    return filter_by_kmers(sequence, search_hard, context);
+  }
+
+  vector< indexType > all_seqs() const {
     vector<indexType> allSeqs;
     for(int i = 0; i < seq_univ_.size(); ++i){      
-      tuple<shared_ptr<MutableAlignment>, char, set<int>> forward = make_tuple(seq_univ_[i], '+', set<int>());
-      tuple<shared_ptr<MutableAlignment>, char, set<int>> reverse = make_tuple(seq_univ_[i], '-', set<int>());
+      indexType forward = make_tuple(seq_univ_[i], '+', set<int>(), 0);
+      indexType reverse = make_tuple(seq_univ_[i], '-', set<int>(), 0);
       allSeqs.push_back(forward);
       allSeqs.push_back(reverse);
     }	      
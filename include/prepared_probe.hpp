@@ -0,0 +1,214 @@
+/**
+Probe sequences prepared once at startup and shared read-only by every
+alignment thread.
+
+A PreparedProbe keeps the probe sequence on both strands and the striped
+query profiles used by the SIMD kernel in sw_aligner.hpp: for each read base
+(A, C, G, T, N) one row of match/mismatch scores over the probe positions,
+laid out in the kernel's segment/lane order, plus the matching mask. There
+is one profile per lane width (8, 16 and 32 bits). Read bases without a
+precomputed row are profiled by the aligner. The probe also keeps its
+bit-parallel match masks, used to reject reads it can not align to.
+*/
+#ifndef PREPARED_PROBE_HPP
+#define PREPARED_PROBE_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <limits>
+
+#include "alignment_parameters.hpp"
+#include "edit_distance_filter.hpp"
+#include "reverse_complement.hpp"
+#include "simd_vector.hpp"
+#include "io_lib_wrapper/mutable_alignment.hpp"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////
+// fill one striped profile row for the first length columns of the
+// reference: scores[k] is the score of aligning base against reference[j],
+// matches[k] is -1 where they are identical. Column j sits at
+// k = (j % seg_len) * lanes + j / seg_len, padding columns score as
+// mismatches.
+//////////////////////////////////////////////////////////////////////////
+template <class T>
+void striped_profile_row(const string & reference, int length, unsigned char base,
+			 int lanes, int seg_len, int match, int mismatch,
+			 T * scores, T * matches){
+  int stripe = seg_len * lanes;
+  fill(scores, scores + stripe, mismatch);
+  fill(matches, matches + stripe, 0);
+  for(int j = 0; j < length; ++j){
+    if((unsigned char) reference[j] == base){
+      int k = (j % seg_len) * lanes + (j / seg_len);
+      scores[k] = match;
+      matches[k] = -1;
+    }
+  }
+}
+
+class PreparedProbe{
+
+  shared_ptr< MutableAlignment > probe_;
+  string name_;
+  string sequence_;
+  string reverse_sequence_;
+  int match_;
+  int mismatch_;
+  int profile_row_[256];
+  int profile_stripe8_;
+  int profile_stripe16_;
+  int profile_stripe32_;
+  vector< int8_t > profile8_;
+  vector< int16_t > profile16_;
+  vector< int32_t > profile32_;
+  BitPattern pattern_;
+  int max_edit_distance_;
+
+  //////////////////////////////////////////////////////////////////
+  // striped rows for one lane width, left empty when the scores do
+  // not fit in T (the kernel never runs that narrow for them)
+  //////////////////////////////////////////////////////////////////
+  template <class T>
+  void build_profile_width_(int lanes, vector< T > & profile, int & stripe){
+    const string profiled_bases = "ACGTN";
+    stripe = 0;
+    if(match_ > numeric_limits<T>::max() or mismatch_ < numeric_limits<T>::min()){
+      return;
+    }
+    int seg_len = (sequence_.size() + lanes - 1) / lanes;
+    stripe = seg_len * lanes;
+    profile.resize(2 * stripe * profiled_bases.size());
+    for(int i = 0; i < profiled_bases.size(); ++i){
+      T * scores = profile.data() + 2 * stripe * i;
+      striped_profile_row(sequence_, sequence_.size(), profiled_bases[i], lanes, seg_len,
+			  match_, mismatch_, scores, scores + stripe);
+    }
+  }
+
+  template <class T>
+  const T * find_profile_row_(const vector< T > & profile, int stripe, int profile_lanes,
+			      unsigned char base, int lanes, int match, int mismatch) const {
+    if(lanes == profile_lanes and match == match_ and mismatch == mismatch_
+       and profile_row_[base] >= 0 and !profile.empty()){
+      return profile.data() + 2 * stripe * profile_row_[base];
+    }
+    return nullptr;
+  }
+
+  void build_profile_(){
+    fill(profile_row_, profile_row_ + 256, -1);
+    profile_stripe8_ = 0;
+    profile_stripe16_ = 0;
+    profile_stripe32_ = 0;
+#if SWIFR_SIMD
+    const string profiled_bases = "ACGTN";
+    for(int i = 0; i < profiled_bases.size(); ++i){
+      profile_row_[(unsigned char) profiled_bases[i]] = i;
+    }
+    build_profile_width_(simd_int8::lanes, profile8_, profile_stripe8_);
+    build_profile_width_(simd_int16::lanes, profile16_, profile_stripe16_);
+    build_profile_width_(simd_int32::lanes, profile32_, profile_stripe32_);
+#endif
+  }
+
+public:
+
+  PreparedProbe(shared_ptr< MutableAlignment > probe,
+		alignment_parameters aln_settings){
+    probe_ = probe;
+    name_ = probe->get_read_id();
+    sequence_ = probe->get_sequence();
+    reverse_sequence_ = reverse_complement(sequence_);
+    match_ = aln_settings.match;
+    mismatch_ = aln_settings.mismatch;
+    build_profile_();
+    pattern_ = BitPattern(sequence_);
+    max_edit_distance_ = max_edit_distance(aln_settings, sequence_.size());
+  }
+
+  shared_ptr< MutableAlignment > probe() const { return probe_; }
+  const string & name() const { return name_; }
+  const string & sequence() const { return sequence_; }
+  const string & reverse_sequence() const { return reverse_sequence_; }
+
+  //////////////////////////////////////////////////////////////////
+  // false when no local alignment of the probe against this strand
+  // of the read can reach the minimum alignment score
+  //////////////////////////////////////////////////////////////////
+  bool may_align(const string & read_sequence) const {
+    return pattern_.matches(read_sequence, max_edit_distance_);
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // profile scores for one read base followed by its match mask,
+  // nullptr if the row was not precomputed for these settings
+  //////////////////////////////////////////////////////////////////
+  template <class T>
+  const T * profile_row(unsigned char base, int lanes, int match, int mismatch) const {
+    return nullptr;
+  }
+};
+
+#if SWIFR_SIMD
+template <>
+inline const int8_t * PreparedProbe::profile_row<int8_t>(unsigned char base, int lanes,
+							 int match, int mismatch) const {
+  return find_profile_row_(profile8_, profile_stripe8_, simd_int8::lanes, base, lanes, match, mismatch);
+}
+
+template <>
+inline const int16_t * PreparedProbe::profile_row<int16_t>(unsigned char base, int lanes,
+							   int match, int mismatch) const {
+  return find_profile_row_(profile16_, profile_stripe16_, simd_int16::lanes, base, lanes, match, mismatch);
+}
+
+template <>
+inline const int32_t * PreparedProbe::profile_row<int32_t>(unsigned char base, int lanes,
+							   int match, int mismatch) const {
+  return find_profile_row_(profile32_, profile_stripe32_, simd_int32::lanes, base, lanes, match, mismatch);
+}
+#endif
+
+///////////////////////////////////////////////////////////////
+// all probes of a run, looked up by their sequence pointer
+///////////////////////////////////////////////////////////////
+class ProbeSet{
+
+  vector< PreparedProbe > probes_;
+  unordered_map< const MutableAlignment *, int > probe_ids_;
+
+public:
+
+  ProbeSet(vector< shared_ptr< MutableAlignment > > sequences,
+	   alignment_parameters aln_settings){
+    probes_.reserve(sequences.size());
+    for(int i = 0; i < sequences.size(); ++i){
+      probes_.push_back(PreparedProbe(sequences[i], aln_settings));
+      probe_ids_[sequences[i].get()] = i;
+    }
+  }
+
+  int size() const {
+    return probes_.size();
+  }
+
+  const PreparedProbe & at(int probe_id) const {
+    return probes_[probe_id];
+  }
+
+  int id(const shared_ptr< MutableAlignment > & sequence) const {
+    return probe_ids_.at(sequence.get());
+  }
+
+  const PreparedProbe & find(const shared_ptr< MutableAlignment > & sequence) const {
+    return probes_[id(sequence)];
+  }
+};
+
+#endif
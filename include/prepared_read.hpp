@@ -0,0 +1,45 @@
+/**
+A read with both of its strands, built once when the read is taken off the
+queue and shared by every probe it is aligned against.
+*/
+#ifndef PREPARED_READ_HPP
+#define PREPARED_READ_HPP
+
+#include <string>
+#include <memory>
+#include <algorithm>
+
+#include "reverse_complement.hpp"
+#include "io_lib_wrapper/mutable_alignment.hpp"
+
+using namespace std;
+
+class PreparedRead{
+
+  shared_ptr< MutableAlignment > read_;
+  string name_;
+  string forward_;
+  string reverse_;
+
+public:
+
+  PreparedRead(shared_ptr< MutableAlignment > read){
+    read_ = read;
+    name_ = read->get_read_id();
+    forward_ = read->get_sequence();
+    reverse_ = reverse_complement(forward_);
+  }
+
+  shared_ptr< MutableAlignment > read() const { return read_; }
+  const string & name() const { return name_; }
+
+  // the read as seen by probes aligning on the given strand
+  const string & sequence(const string & strand) const {
+    if(strand == "-"){
+      return reverse_;
+    }
+    return forward_;
+  }
+};
+
+#endif
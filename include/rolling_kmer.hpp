@@ -0,0 +1,229 @@
+/**
+Kmers of a sequence as 2-bit codes, rolled one base at a time.
+
+A RollingKmer keeps the code of the last k bases and of their reverse
+complement; each base shifts one in and the oldest out in O(1), without
+building a string per kmer. The first base of a kmer is its most
+significant. A base other than A/C/G/T empties the window, so no kmer
+spans it. Codes are 32 bits wide for k up to 16 and 64 bits wide (the
+WideRollingKmer) for k up to 32.
+
+A MinimizerWindow samples the (w,k)-minimizers of those kmers, for
+indexes that keep only about 2/(w+1) of them.
+*/
+#ifndef ROLLING_KMER_HPP
+#define ROLLING_KMER_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <tuple>
+#include <vector>
+
+#include "base_code.hpp"
+
+using namespace std;
+
+// longest kmers with 32 and 64 bit codes
+const int MAX_NARROW_KMER_SIZE = 16;
+const int MAX_KMER_SIZE = 32;
+// widest minimizer window, whose sampled kmers are at most 255 kmers
+// apart for the 8 bit spans of the index postings
+const int MAX_MINIMIZER_WINDOW = 256;
+// most mismatches of an indexed kmer, every posting has C(k, m) 3^m
+// neighbours
+const int MAX_KMER_MISMATCHES = 2;
+
+template <class Code>
+class BasicRollingKmer{
+
+  int kmer_size_;
+  Code mask_;
+  int high_shift_;
+  Code forward_;
+  Code reverse_;
+  // bases since the window was last emptied
+  int filled_;
+
+public:
+
+  // kmer_size up to 4 bases a byte of Code, no kmers are made below 1
+  BasicRollingKmer(int kmer_size){
+    kmer_size_ = max(kmer_size, 0);
+    mask_ = kmer_size_ >= 4 * (int) sizeof(Code) ? ~Code(0) : (Code(1) << (2 * kmer_size_)) - 1;
+    high_shift_ = 2 * max(kmer_size_ - 1, 0);
+    reset();
+  }
+
+  void reset(){
+    forward_ = 0;
+    reverse_ = 0;
+    filled_ = 0;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // add the next base, true when the last kmer_size bases make a
+  // kmer, one of A/C/G/T only
+  ////////////////////////////////////////////////////////////////
+  bool push(char base){
+    Code code = base_code(base);
+    if(code == BASE_CODE_OTHER){
+      reset();
+      return false;
+    }
+    forward_ = ((forward_ << 2) | code) & mask_;
+    reverse_ = (reverse_ >> 2) | ((3 - code) << high_shift_);
+    ++filled_;
+    return kmer_size_ > 0 and filled_ >= kmer_size_;
+  }
+
+  // the kmer ending at the last base
+  Code forward() const {
+    return forward_;
+  }
+
+  // its reverse complement
+  Code reverse() const {
+    return reverse_;
+  }
+};
+
+typedef BasicRollingKmer< uint32_t > RollingKmer;
+typedef BasicRollingKmer< uint64_t > WideRollingKmer;
+
+//////////////////////////////////////////////////////////////////////
+// code of the reverse complement of a kmer of kmer_size (at least 1)
+// bases: the bases complemented, then their 2-bit groups reversed
+//////////////////////////////////////////////////////////////////////
+inline uint32_t reverse_complement_code(uint32_t code, int kmer_size){
+  code = ~code;
+  code = ((code >> 2) & 0x33333333) | ((code & 0x33333333) << 2);
+  code = ((code >> 4) & 0x0f0f0f0f) | ((code & 0x0f0f0f0f) << 4);
+  code = ((code >> 8) & 0x00ff00ff) | ((code & 0x00ff00ff) << 8);
+  code = (code >> 16) | (code << 16);
+  return code >> (32 - 2 * kmer_size);
+}
+
+inline uint64_t reverse_complement_code(uint64_t code, int kmer_size){
+  code = ~code;
+  code = ((code >> 2) & 0x3333333333333333ULL) | ((code & 0x3333333333333333ULL) << 2);
+  code = ((code >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((code & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  code = ((code >> 8) & 0x00ff00ff00ff00ffULL) | ((code & 0x00ff00ff00ff00ffULL) << 8);
+  code = ((code >> 16) & 0x0000ffff0000ffffULL) | ((code & 0x0000ffff0000ffffULL) << 16);
+  code = (code >> 32) | (code << 32);
+  return code >> (64 - 2 * kmer_size);
+}
+
+// scrambles kmer codes so minimizers are not biased towards poly-A,
+// invertible so distinct kmers never tie
+inline uint32_t kmer_hash(uint32_t kmer){
+  kmer ^= kmer >> 16;
+  kmer *= 0x85ebca6b;
+  kmer ^= kmer >> 13;
+  kmer *= 0xc2b2ae35;
+  kmer ^= kmer >> 16;
+  return kmer;
+}
+
+inline uint64_t kmer_hash(uint64_t kmer){
+  kmer ^= kmer >> 33;
+  kmer *= 0xff51afd7ed558ccdULL;
+  kmer ^= kmer >> 33;
+  kmer *= 0xc4ceb9fe1a85ec53ULL;
+  kmer ^= kmer >> 33;
+  return kmer;
+}
+
+//////////////////////////////////////////////////////////////////////
+// (w,k)-minimizers of the kmers of a sequence: every kmer whose hash is
+// the smallest of some window of w consecutive kmer positions, ties
+// included, so a probe and its occurrence in a read sample the same
+// kmers over the windows they share. Positions without a kmer (next to
+// an N) are in windows but never sampled. A sequence with fewer than w
+// kmer positions is one window. w = 1 samples every kmer.
+//////////////////////////////////////////////////////////////////////
+template <class Code>
+class BasicMinimizerWindow{
+
+  int window_;
+  // position, hash and kmer of the window's candidates, hashes not
+  // decreasing from the front
+  deque< tuple<int, Code, Code> > candidates_;
+  int positions_;
+  int last_sampled_;
+
+  void sample_(vector< pair<int, Code> > & sampled){
+    if(candidates_.empty()){
+      return;
+    }
+    Code smallest = get<1>(candidates_.front());
+    for(auto & candidate : candidates_){
+      if(get<1>(candidate) != smallest){
+	break;
+      }
+      if(get<0>(candidate) > last_sampled_){
+	last_sampled_ = get<0>(candidate);
+	sampled.push_back(make_pair(get<0>(candidate), get<2>(candidate)));
+      }
+    }
+  }
+
+public:
+
+  BasicMinimizerWindow(int window){
+    window_ = max(window, 1);
+    reset();
+  }
+
+  void reset(){
+    candidates_.clear();
+    positions_ = 0;
+    last_sampled_ = -1;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // the next kmer position, has_kmer false where there is none.
+  // Appends (position, kmer) of the kmers sampled by the window
+  // ending here.
+  ////////////////////////////////////////////////////////////////
+  void push(bool has_kmer, Code kmer, vector< pair<int, Code> > & sampled){
+    push(has_kmer, kmer, kmer, sampled);
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // the same, ranking the kmer by the hash of order_key instead of
+  // its own, so both strands of a sequence can sample the same
+  // positions
+  ////////////////////////////////////////////////////////////////
+  void push(bool has_kmer, Code kmer, Code order_key, vector< pair<int, Code> > & sampled){
+    int pos = positions_++;
+    if(has_kmer){
+      Code hash = kmer_hash(order_key);
+      while(!candidates_.empty() and get<1>(candidates_.back()) > hash){
+	candidates_.pop_back();
+      }
+      candidates_.push_back(make_tuple(pos, hash, kmer));
+    }
+    while(!candidates_.empty() and get<0>(candidates_.front()) <= pos - window_){
+      candidates_.pop_front();
+    }
+    if(positions_ >= window_){
+      sample_(sampled);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // end of the sequence, samples the one short window of a
+  // sequence with fewer than w kmer positions
+  ////////////////////////////////////////////////////////////////
+  void finish(vector< pair<int, Code> > & sampled){
+    if(positions_ < window_){
+      sample_(sampled);
+    }
+  }
+};
+
+typedef BasicMinimizerWindow< uint32_t > MinimizerWindow;
+typedef BasicMinimizerWindow< uint64_t > WideMinimizerWindow;
+
+#endif
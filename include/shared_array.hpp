@@ -0,0 +1,56 @@
+/**
+A read-only array shared between its users, backed either by a vector it
+took over or by memory someone else owns, such as a mapped index file. The
+owner is kept alive by every copy, so copies are cheap and the arrays of a
+mapped file need no copying at all.
+*/
+#ifndef SHARED_ARRAY_HPP
+#define SHARED_ARRAY_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+using namespace std;
+
+template <class T>
+class SharedArray{
+
+  shared_ptr< const void > owner_;
+  const T * data_;
+  size_t size_;
+
+public:
+
+  SharedArray(){
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  SharedArray(vector< T > values){
+    shared_ptr< vector< T > > owned(new vector< T >());
+    owned->swap(values);
+    data_ = owned->data();
+    size_ = owned->size();
+    owner_ = owned;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // size elements at data, valid for as long as owner lives
+  ////////////////////////////////////////////////////////////////
+  SharedArray(shared_ptr< const void > owner, const T * data, size_t size){
+    owner_ = owner;
+    data_ = data;
+    size_ = size;
+  }
+
+  const T * data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T * begin() const { return data_; }
+  const T * end() const { return data_ + size_; }
+  const T & operator[](size_t i) const { return data_[i]; }
+  const T & back() const { return data_[size_ - 1]; }
+};
+
+#endif
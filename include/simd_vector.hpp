@@ -0,0 +1,203 @@
+/**
+Thin wrappers around the SSE4.1 / AVX2 integer intrinsics used by the striped
+Smith-Waterman kernel in sw_aligner.hpp. The same operations are provided for
+8, 16 and 32-bit lanes so the kernel can start narrow and redo the rare
+alignments that come close to the limits of a lane at a wider width.
+
+The widest instruction set enabled at compile time is used (-mavx2, -msse4.1).
+When neither is available SWIFR_SIMD is 0 and the aligner falls back to the
+scalar scoring loop.
+
+Masks follow the intrinsic convention: all bits set in a lane = true.
+*/
+#ifndef SIMD_VECTOR_HPP
+#define SIMD_VECTOR_HPP
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SWIFR_SIMD 1
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define SWIFR_SIMD 1
+#else
+#define SWIFR_SIMD 0
+#endif
+
+#if SWIFR_SIMD
+
+//////////////////////////////////////
+// 32-bit signed lanes, exact scores
+//////////////////////////////////////
+struct simd_int32 {
+  typedef int32_t value_type;
+
+#if defined(__AVX2__)
+  typedef __m256i vec;
+  static const int lanes = 8;
+
+  static vec load(const value_type * p){ return _mm256_loadu_si256((const vec *) p); }
+  static void store(value_type * p, vec v){ _mm256_storeu_si256((vec *) p, v); }
+  static vec set1(value_type x){ return _mm256_set1_epi32(x); }
+  static vec zero(){ return _mm256_setzero_si256(); }
+  static vec add(vec a, vec b){ return _mm256_add_epi32(a, b); }
+  static vec max(vec a, vec b){ return _mm256_max_epi32(a, b); }
+  static vec cmpgt(vec a, vec b){ return _mm256_cmpgt_epi32(a, b); }
+  static vec cmpeq(vec a, vec b){ return _mm256_cmpeq_epi32(a, b); }
+  static vec and_(vec a, vec b){ return _mm256_and_si256(a, b); }
+  static vec or_(vec a, vec b){ return _mm256_or_si256(a, b); }
+  // ~a & b
+  static vec andnot(vec a, vec b){ return _mm256_andnot_si256(a, b); }
+  // mask ? b : a
+  static vec blend(vec a, vec b, vec mask){ return _mm256_blendv_epi8(a, b, mask); }
+  static bool any(vec mask){ return !_mm256_testz_si256(mask, mask); }
+  // move every lane up by one, x enters lane 0
+  static vec shift_in(vec v, value_type x){
+    vec low = _mm256_permute2x128_si256(v, v, 0x08);
+    return _mm256_insert_epi32(_mm256_alignr_epi8(v, low, 12), x, 0);
+  }
+#else
+  typedef __m128i vec;
+  static const int lanes = 4;
+
+  static vec load(const value_type * p){ return _mm_loadu_si128((const vec *) p); }
+  static void store(value_type * p, vec v){ _mm_storeu_si128((vec *) p, v); }
+  static vec set1(value_type x){ return _mm_set1_epi32(x); }
+  static vec zero(){ return _mm_setzero_si128(); }
+  static vec add(vec a, vec b){ return _mm_add_epi32(a, b); }
+  static vec max(vec a, vec b){ return _mm_max_epi32(a, b); }
+  static vec cmpgt(vec a, vec b){ return _mm_cmpgt_epi32(a, b); }
+  static vec cmpeq(vec a, vec b){ return _mm_cmpeq_epi32(a, b); }
+  static vec and_(vec a, vec b){ return _mm_and_si128(a, b); }
+  static vec or_(vec a, vec b){ return _mm_or_si128(a, b); }
+  // ~a & b
+  static vec andnot(vec a, vec b){ return _mm_andnot_si128(a, b); }
+  // mask ? b : a
+  static vec blend(vec a, vec b, vec mask){ return _mm_blendv_epi8(a, b, mask); }
+  static bool any(vec mask){ return !_mm_testz_si128(mask, mask); }
+  // move every lane up by one, x enters lane 0
+  static vec shift_in(vec v, value_type x){
+    return _mm_insert_epi32(_mm_slli_si128(v, 4), x, 0);
+  }
+#endif
+};
+
+//////////////////////////////////////////////////////////////
+// 16-bit signed lanes with saturating adds, callers detect
+// scores that get close to the limits and redo them wider
+//////////////////////////////////////////////////////////////
+struct simd_int16 {
+  typedef int16_t value_type;
+
+#if defined(__AVX2__)
+  typedef __m256i vec;
+  static const int lanes = 16;
+
+  static vec load(const value_type * p){ return _mm256_loadu_si256((const vec *) p); }
+  static void store(value_type * p, vec v){ _mm256_storeu_si256((vec *) p, v); }
+  static vec set1(value_type x){ return _mm256_set1_epi16(x); }
+  static vec zero(){ return _mm256_setzero_si256(); }
+  static vec add(vec a, vec b){ return _mm256_adds_epi16(a, b); }
+  static vec max(vec a, vec b){ return _mm256_max_epi16(a, b); }
+  static vec cmpgt(vec a, vec b){ return _mm256_cmpgt_epi16(a, b); }
+  static vec cmpeq(vec a, vec b){ return _mm256_cmpeq_epi16(a, b); }
+  static vec and_(vec a, vec b){ return _mm256_and_si256(a, b); }
+  static vec or_(vec a, vec b){ return _mm256_or_si256(a, b); }
+  // ~a & b
+  static vec andnot(vec a, vec b){ return _mm256_andnot_si256(a, b); }
+  // mask ? b : a
+  static vec blend(vec a, vec b, vec mask){ return _mm256_blendv_epi8(a, b, mask); }
+  static bool any(vec mask){ return !_mm256_testz_si256(mask, mask); }
+  // move every lane up by one, x enters lane 0
+  static vec shift_in(vec v, value_type x){
+    vec low = _mm256_permute2x128_si256(v, v, 0x08);
+    return _mm256_insert_epi16(_mm256_alignr_epi8(v, low, 14), x, 0);
+  }
+#else
+  typedef __m128i vec;
+  static const int lanes = 8;
+
+  static vec load(const value_type * p){ return _mm_loadu_si128((const vec *) p); }
+  static void store(value_type * p, vec v){ _mm_storeu_si128((vec *) p, v); }
+  static vec set1(value_type x){ return _mm_set1_epi16(x); }
+  static vec zero(){ return _mm_setzero_si128(); }
+  static vec add(vec a, vec b){ return _mm_adds_epi16(a, b); }
+  static vec max(vec a, vec b){ return _mm_max_epi16(a, b); }
+  static vec cmpgt(vec a, vec b){ return _mm_cmpgt_epi16(a, b); }
+  static vec cmpeq(vec a, vec b){ return _mm_cmpeq_epi16(a, b); }
+  static vec and_(vec a, vec b){ return _mm_and_si128(a, b); }
+  static vec or_(vec a, vec b){ return _mm_or_si128(a, b); }
+  // ~a & b
+  static vec andnot(vec a, vec b){ return _mm_andnot_si128(a, b); }
+  // mask ? b : a
+  static vec blend(vec a, vec b, vec mask){ return _mm_blendv_epi8(a, b, mask); }
+  static bool any(vec mask){ return !_mm_testz_si128(mask, mask); }
+  // move every lane up by one, x enters lane 0
+  static vec shift_in(vec v, value_type x){
+    return _mm_insert_epi16(_mm_slli_si128(v, 2), x, 0);
+  }
+#endif
+};
+
+
+//////////////////////////////////////////////////////////////
+// 8-bit signed lanes with saturating adds, callers detect
+// scores that get close to the limits and redo them wider
+//////////////////////////////////////////////////////////////
+struct simd_int8 {
+  typedef int8_t value_type;
+
+#if defined(__AVX2__)
+  typedef __m256i vec;
+  static const int lanes = 32;
+
+  static vec load(const value_type * p){ return _mm256_loadu_si256((const vec *) p); }
+  static void store(value_type * p, vec v){ _mm256_storeu_si256((vec *) p, v); }
+  static vec set1(value_type x){ return _mm256_set1_epi8(x); }
+  static vec zero(){ return _mm256_setzero_si256(); }
+  static vec add(vec a, vec b){ return _mm256_adds_epi8(a, b); }
+  static vec max(vec a, vec b){ return _mm256_max_epi8(a, b); }
+  static vec cmpgt(vec a, vec b){ return _mm256_cmpgt_epi8(a, b); }
+  static vec cmpeq(vec a, vec b){ return _mm256_cmpeq_epi8(a, b); }
+  static vec and_(vec a, vec b){ return _mm256_and_si256(a, b); }
+  static vec or_(vec a, vec b){ return _mm256_or_si256(a, b); }
+  // ~a & b
+  static vec andnot(vec a, vec b){ return _mm256_andnot_si256(a, b); }
+  // mask ? b : a
+  static vec blend(vec a, vec b, vec mask){ return _mm256_blendv_epi8(a, b, mask); }
+  static bool any(vec mask){ return !_mm256_testz_si256(mask, mask); }
+  // move every lane up by one, x enters lane 0
+  static vec shift_in(vec v, value_type x){
+    vec low = _mm256_permute2x128_si256(v, v, 0x08);
+    return _mm256_insert_epi8(_mm256_alignr_epi8(v, low, 15), x, 0);
+  }
+#else
+  typedef __m128i vec;
+  static const int lanes = 16;
+
+  static vec load(const value_type * p){ return _mm_loadu_si128((const vec *) p); }
+  static void store(value_type * p, vec v){ _mm_storeu_si128((vec *) p, v); }
+  static vec set1(value_type x){ return _mm_set1_epi8(x); }
+  static vec zero(){ return _mm_setzero_si128(); }
+  static vec add(vec a, vec b){ return _mm_adds_epi8(a, b); }
+  static vec max(vec a, vec b){ return _mm_max_epi8(a, b); }
+  static vec cmpgt(vec a, vec b){ return _mm_cmpgt_epi8(a, b); }
+  static vec cmpeq(vec a, vec b){ return _mm_cmpeq_epi8(a, b); }
+  static vec and_(vec a, vec b){ return _mm_and_si128(a, b); }
+  static vec or_(vec a, vec b){ return _mm_or_si128(a, b); }
+  // ~a & b
+  static vec andnot(vec a, vec b){ return _mm_andnot_si128(a, b); }
+  // mask ? b : a
+  static vec blend(vec a, vec b, vec mask){ return _mm_blendv_epi8(a, b, mask); }
+  static bool any(vec mask){ return !_mm_testz_si128(mask, mask); }
+  // move every lane up by one, x enters lane 0
+  static vec shift_in(vec v, value_type x){
+    return _mm_insert_epi8(_mm_slli_si128(v, 1), x, 0);
+  }
+#endif
+};
+
+#endif
+
+#endif
@@ -3,12 +3,12 @@ This is an object designed to perform smith waterman alignment between two strin
 and produce a list of alignments, if any are found.
 
 Primary Functionality:
-1) allocate memory for score and traceback matrices
+1) prepare score and traceback matrices in the per-thread workspace
 2) score matrices using the smith-waterman method (parameters: match, mismatch, gap open, gap extend)
 3) find local maxima in the score matrix satisfying a minimum alignment score.
 4) trace all alignments producing cigars
 5) optionally identify end-to-end alignments
-6) deallocate memory 
+6) keep the workspace for the next alignment
 7) report all aspects of the alignment:
 
 reference start= 291
@@ -44,19 +44,89 @@ which will specify which part of the reference sequence to align against.
 #include <string>
 #include <algorithm>
 #include <tuple>
+#include <vector>
+#include <set>
+#include <deque>
+#include <limits>
+#include <cmath>
 
 #include "alignment_parameters.hpp"
 #include "alignment_report.hpp"
+#include "alignment_workspace.hpp"
+#include "cigar.hpp"
+#include "prepared_probe.hpp"
+#include "prepared_read.hpp"
 #include "io_lib_wrapper/mutable_alignment.hpp"
+#include "simd_vector.hpp"
 
 
 using namespace std;
 
+// about 128MB of scores per thread before the traceback is checkpointed
+const long DEFAULT_TRACE_CELL_LIMIT = 1L << 25;
+
 struct maxima_coords {
   int query_pos = 0;
   int ref_pos = 0;
   int aln_score = 0;
 };
+
+////////////////////////////////////////////////////////////////////////
+// true if maximum a is preferred over b: higher score, then farther
+// along the query, then the more concise alignment (smaller ref_pos)
+////////////////////////////////////////////////////////////////////////
+inline bool better_maxima(const maxima_coords & a, const maxima_coords & b){
+  if(a.aln_score != b.aln_score){
+    return a.aln_score > b.aln_score;
+  }
+  if(a.query_pos != b.query_pos){
+    return a.query_pos > b.query_pos;
+  }
+  return a.ref_pos < b.ref_pos;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// keep the maxima no other maximum closer than window along the
+// reference is preferred over, in their input order. One sweep over the
+// maxima sorted by ref_pos, a deque holds the window's candidates in
+// decreasing preference so its front is the best maximum in the window.
+//////////////////////////////////////////////////////////////////////////
+inline vector< maxima_coords > filter_overlapping_maxima(const vector< maxima_coords > & maxima,
+							 double window){
+  vector< int > order(maxima.size());
+  for(int i = 0; i < maxima.size(); ++i){
+    order[i] = i;
+  }
+  stable_sort(order.begin(), order.end(), [&maxima](int a, int b){
+      return maxima[a].ref_pos < maxima[b].ref_pos;
+    });
+  vector< bool > keep(maxima.size(), false);
+  deque< int > best;
+  int next = 0;
+  for(int i : order){
+    const maxima_coords & current = maxima[i];
+    // enter maxima ahead of the current one, drop those behind the window
+    while(next < order.size() and maxima[order[next]].ref_pos - current.ref_pos < window){
+      const maxima_coords & entering = maxima[order[next]];
+      while(!best.empty() and !better_maxima(maxima[best.back()], entering)){
+	best.pop_back();
+      }
+      best.push_back(order[next]);
+      ++next;
+    }
+    while(!best.empty() and current.ref_pos - maxima[best.front()].ref_pos >= window){
+      best.pop_front();
+    }
+    keep[i] = best.empty() or !better_maxima(maxima[best.front()], current);
+  }
+  vector< maxima_coords > filtered_maxima;
+  for(int i = 0; i < maxima.size(); ++i){
+    if(keep[i]){
+      filtered_maxima.push_back(maxima[i]);
+    }
+  }
+  return filtered_maxima;
+}
   
 //////////////////////////////////////////////////////////////////////
 // an object for performing Smith-Waterman alignments on two strings
@@ -69,10 +139,28 @@ class SWAligner{
   int * reference_maxima_;
   int * query_maxima_index_;
   int ** aln_array_;
-  int ** traceback_matrix_;
+  TracebackMatrix traceback_matrix_;
+  AlignmentWorkspace workspace_;
+  const PreparedProbe * prepared_probe_;
+  shared_ptr< MutableAlignment > cached_read_;
+  string read_forward_;
+  string read_reverse_;
   bool debug_;
   bool global_aln_;
   int search_dist_;
+  bool use_simd_;
+  int band_width_;
+  // tracebacks over more cells than this are scored in blocks of rows
+  long trace_cell_limit_;
+  int block_rows_;
+  int trace_rows_;
+  int trace_cols_;
+  int trace_block_;
+  int * checkpoint_scores_;
+  uint8_t * checkpoint_traceback_;
+  // X-drop of seed windows, negative when off, and of the running pass
+  int x_drop_;
+  int pass_x_drop_;
   string strand_;
 
   
@@ -102,51 +190,102 @@ class SWAligner{
   }
   
   
-  ////////////////////////////////////////////////////
-  //  allocate memory for alignment/traceback array
-  ///////////////////////////////////////////////////
-  int ** allocate_matrix_(){
-    int que_pos = 0;
-    int ref_pos = 0;
-    // allocate new memory for array, with extra row & col for SW 
-    int ** maloc_array = new int*[(query_.size()+1)];
-    for(int i = 0; i < (query_.size()+1); ++i){
-      maloc_array[i] = new int[(reference_.size()+1)](); //initialize to set to zero
+  ///////////////////////////////////////////////////////////////////
+  //  point the alignment/traceback arrays into the workspace for the
+  //  score-only pass: two rolling rows and the maxima arrays
+  ///////////////////////////////////////////////////////////////////
+  void prepare_score_pass_(){
+    int rows = query_.size() + 1;
+    int cols = reference_.size() + 1;
+    aln_array_ = workspace_.rolling_score_matrix(rows, cols);
+    traceback_matrix_ = workspace_.rolling_traceback_matrix(rows, cols);
+    reference_maxima_ = workspace_.reference_maxima(reference_.size());
+    query_maxima_index_ = workspace_.query_maxima_index(reference_.size());
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  //  full alignment/traceback matrices for the first que_len query
+  //  and ref_len reference positions
+  ///////////////////////////////////////////////////////////////////
+  void prepare_traceback_pass_(int que_len, int ref_len){
+    aln_array_ = workspace_.score_matrix(que_len + 1, ref_len + 1);
+    traceback_matrix_ = workspace_.traceback_matrix(que_len + 1, ref_len + 1);
+  }
+
+  ///////////////////////////////////////////////////////////////////////
+  //  fill the matrices the trace reads for the first que_len query and
+  //  ref_len reference positions. Above the cell limit only a block of
+  //  about sqrt(que_len) rows is kept, with the row above every block
+  //  saved as a checkpoint; the trace rescores a block from its
+  //  checkpoint when it enters it. Memory grows with sqrt(que_len)
+  //  instead of que_len for about one extra scoring pass.
+  ///////////////////////////////////////////////////////////////////////
+  void traceback_pass_(int que_len, int ref_len){
+    block_rows_ = 0;
+    if((long) (que_len + 1) * (ref_len + 1) <= trace_cell_limit_){
+      prepare_traceback_pass_(que_len, ref_len);
+      score_pass_(que_len, ref_len, true);
+      return;
     }
-    return maloc_array;
+    block_rows_ = max(1, (int) sqrt((double) que_len));
+    trace_rows_ = que_len;
+    trace_cols_ = ref_len;
+    int blocks = (que_len + block_rows_ - 1) / block_rows_;
+    aln_array_ = workspace_.blocked_score_matrix(que_len + 1, ref_len + 1, block_rows_);
+    traceback_matrix_ = workspace_.blocked_traceback_matrix(que_len + 1, ref_len + 1, block_rows_);
+    checkpoint_scores_ = workspace_.checkpoint_scores(blocks, ref_len + 1);
+    checkpoint_traceback_ = workspace_.checkpoint_traceback(blocks, ref_len + 1);
+    for(int block = 0; block < blocks; ++block){
+      int first_row = block * block_rows_;
+      copy(aln_array_[first_row], aln_array_[first_row] + ref_len + 1,
+	   checkpoint_scores_ + (size_t) block * (ref_len + 1));
+      size_t row_bytes = TracebackMatrix::row_bytes(ref_len + 1);
+      memcpy(checkpoint_traceback_ + block * row_bytes, traceback_matrix_.row(first_row), row_bytes);
+      score_pass_(min(que_len, first_row + block_rows_), ref_len, true, first_row + 1);
+    }
+    trace_block_ = blocks - 1;
   }
-  
-  ////////////////////////////////////////////////////////////
-  //  allocate memory to index the maximum scoring alignments
-  ////////////////////////////////////////////////////////////
-  int * allocate_array_(){
-    int * reference_array = new int[reference_.size()]();
-    return reference_array;
+
+  //////////////////////////////////////////////////////////////////
+  //  make the rows of a checkpointed traceback around que_pos (the
+  //  row itself and the one above it) available to the trace
+  //////////////////////////////////////////////////////////////////
+  void load_trace_rows_(int que_pos){
+    if(block_rows_ == 0 or que_pos == 0){
+      return;
+    }
+    int block = (que_pos - 1) / block_rows_;
+    if(block == trace_block_){
+      return;
+    }
+    int first_row = block * block_rows_;
+    copy(checkpoint_scores_ + (size_t) block * (trace_cols_ + 1),
+	 checkpoint_scores_ + (size_t) (block + 1) * (trace_cols_ + 1), aln_array_[first_row]);
+    size_t row_bytes = TracebackMatrix::row_bytes(trace_cols_ + 1);
+    memcpy(traceback_matrix_.row(first_row), checkpoint_traceback_ + block * row_bytes, row_bytes);
+    score_pass_(min(trace_rows_, first_row + block_rows_), trace_cols_, true, first_row + 1);
+    trace_block_ = block;
   }
-  
-  ////////////////////////////////////////////////////
-  //  allocate memory for alignment/traceback array
-  ///////////////////////////////////////////////////  
-  void allocate_memory_(){
-    aln_array_ = allocate_matrix_();
-    traceback_matrix_ = allocate_matrix_();
-    query_maxima_index_ = allocate_array_();
-    reference_maxima_ = allocate_array_();
-  }
-
-  ////////////////////////////////////////////////
-  //  fill the positions in the alignment array
-  ////////////////////////////////////////////////
-  void score_matrices_(){
+
+  //////////////////////////////////////////////////////////////////
+  //  fill the positions in the alignment array, cells only depend
+  //  on the cells above and to the left so any top-left corner of
+  //  the matrices can be filled on its own, and rows from first_row
+  //  on can be refilled from the row above them
+  //////////////////////////////////////////////////////////////////
+  void score_matrices_(int que_len, int ref_len, int first_row = 1){
     string ref_base, que_base;
-    int que_pos = 1;
-    while(que_pos <= query_.size()){
+    int que_pos = first_row;
+    int best_score = 0;
+    while(que_pos <= que_len){
       int ref_pos = 1;
+      int row_score = 0;
       que_base = query_.substr((que_pos-1),1);
-      while(ref_pos <= reference_.size()){
+      while(ref_pos <= ref_len){
         ref_base = reference_.substr((ref_pos-1),1);
     	int score = calc_score_(ref_base, que_base, ref_pos, que_pos);
 	aln_array_[que_pos][ref_pos] = score;
+	row_score = max(row_score, score);
 	// keeping track of maxima for tracing alignments
 	if(score > reference_maxima_[ref_pos - 1]){
 	  reference_maxima_[ref_pos - 1] = score;
@@ -154,6 +293,10 @@ class SWAligner{
 	}
 	++ref_pos;
       }
+      best_score = max(best_score, row_score);
+      if(x_dropped_(best_score, row_score)){
+	break;
+      }
       ++que_pos;
     }
   }
@@ -183,7 +326,7 @@ class SWAligner{
     // extended insertion
     if(que_pos > 2){
       // as long as previous base does not match, score extension
-      if(traceback_matrix_[que_pos-1][ref_pos] != 0){ 
+      if(traceback_matrix_.get(que_pos-1, ref_pos) != 0){ 
      	all_scores[1] = (aln_array_[que_pos-1][ref_pos] + aln_settings_.insertion_extend);
       }
     }
@@ -192,7 +335,7 @@ class SWAligner{
     // extended deletion
     if(ref_pos > 2){
       // as long as previous base does not match, score extension
-      if(traceback_matrix_[que_pos][ref_pos-1] != 0){ 
+      if(traceback_matrix_.get(que_pos, ref_pos-1) != 0){ 
 	all_scores[2] = (aln_array_[que_pos][ref_pos-1] + aln_settings_.deletion_extend);
       }
     }
@@ -207,20 +350,334 @@ class SWAligner{
   ////////////////////////////////////////////////////////////////////
   //  Define the alignment path that should be taken given the score
   ////////////////////////////////////////////////////////////////////
-  int trace_position_(int que_pos,
+  void trace_position_(int que_pos,
 		      int ref_pos,
 		      bool bases_match,
 		      int all_scores[4]){
     int trace = 0;
     trace = distance(all_scores, max_element(all_scores, all_scores + 3));
     if(!bases_match and trace == 0){
-      traceback_matrix_[que_pos][ref_pos] = -1;
+      traceback_matrix_.set(que_pos, ref_pos, -1);
+    }
+    else{
+      traceback_matrix_.set(que_pos, ref_pos, trace);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  //  fill the positions in the alignment array with the SIMD kernel
+  ////////////////////////////////////////////////////////////////////
+  // the narrowest lane width is tried first, the rare alignments whose
+  // scores come close to its limits are redone at the next width
+  void score_matrices_simd_(int que_len, int ref_len, bool keep_matrices, int first_row = 1){
+#if SWIFR_SIMD
+    if(keep_matrices){
+      if(!score_matrices_striped_<simd_int8, true>(que_len, ref_len, first_row)){
+	if(!score_matrices_striped_<simd_int16, true>(que_len, ref_len, first_row)){
+	  score_matrices_striped_<simd_int32, true>(que_len, ref_len, first_row);
+	}
+      }
     }
     else{
-      traceback_matrix_[que_pos][ref_pos] = trace;
+      if(!score_matrices_striped_<simd_int8, false>(que_len, ref_len)){
+	if(!score_matrices_striped_<simd_int16, false>(que_len, ref_len)){
+	  score_matrices_striped_<simd_int32, false>(que_len, ref_len);
+	}
+      }
     }
+#else
+    score_matrices_(que_len, ref_len, first_row);
+#endif
   }
 
+  ///////////////////////////////////////////////////////////////////
+  // largest change a single cell can make to its neighbour's score
+  ///////////////////////////////////////////////////////////////////
+  int score_step_(){
+    return max(max(abs(aln_settings_.match), abs(aln_settings_.mismatch)),
+	       max(max(abs(aln_settings_.insertion_open), abs(aln_settings_.insertion_extend)),
+		   max(abs(aln_settings_.deletion_open), abs(aln_settings_.deletion_extend))));
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  // X-drop: once the probe has matched, a pass stops extending when
+  // a whole row scores more than pass_x_drop_ below the best cell
+  ///////////////////////////////////////////////////////////////////
+  bool x_dropped_(int best_score, int row_score){
+    return pass_x_drop_ >= 0 and best_score >= aln_settings_.min_aln_score
+      and row_score < best_score - pass_x_drop_;
+  }
+
+  ///////////////////////////////////////////////////////////////////
+  // a local row of zeros scored as mismatches stays that way for
+  // read bases the probe does not contain, if no score is positive
+  ///////////////////////////////////////////////////////////////////
+  bool zero_rows_stay_zero_(){
+    return aln_settings_.mismatch <= 0
+      and aln_settings_.insertion_open <= 0 and aln_settings_.insertion_extend <= 0
+      and aln_settings_.deletion_open <= 0 and aln_settings_.deletion_extend <= 0;
+  }
+
+#if SWIFR_SIMD
+  //////////////////////////////////////////////////////////////////////////
+  // striped Smith-Waterman (Farrar 2007) with the scoring rules of
+  // calc_score_/trace_position_. The reference is striped across the
+  // vector lanes (column j lives in segment j % seg_len, lane j / seg_len)
+  // and every query position is one pass over the segments. The gap
+  // extension test looks at the traceback of the neighbouring cell, so the
+  // per-cell flag (traceback != 0) is carried along with the scores.
+  // Deletions depend on the previous column, which for segment 0 sits in
+  // the previous lane: those values are corrected lazily by re-running
+  // segments until no score or flag changes.
+  // Lanes narrower than int saturate, so every finished row is checked to
+  // stay one step away from the limits of value_type. If it does, every
+  // add was exact; otherwise false is returned and the caller redoes the
+  // alignment wider.
+  // Without keep_matrices only the maxima arrays and the last row of the
+  // score matrix are written, which is all the search for maxima reads.
+  // With keep_matrices, scoring can resume at first_row from the scores
+  // and traceback of the row above it.
+  //////////////////////////////////////////////////////////////////////////
+  template <class V, bool keep_matrices>
+  bool score_matrices_striped_(int que_len, int ref_len, int first_row = 1){
+    typedef typename V::vec vec;
+    typedef typename V::value_type value_type;
+    const int lanes = V::lanes;
+    const int seg_len = (ref_len + lanes - 1) / lanes;
+    const int stripe = seg_len * lanes;
+    const bool exact = sizeof(value_type) >= sizeof(int);
+    const int step = score_step_();
+    if(ref_len == 0){
+      return true;
+    }
+    if(!exact and 2 * step >= numeric_limits<value_type>::max()){
+      return false;
+    }
+    value_type * buffers = workspace_.kernel_buffer<value_type>(8 * stripe);
+    value_type * h_prev = buffers;
+    value_type * h_cur = buffers + stripe;
+    value_type * f_prev = buffers + 2 * stripe;
+    value_type * f_cur = buffers + 3 * stripe;
+    value_type * trace = buffers + 4 * stripe;
+    value_type * ext_ok = buffers + 5 * stripe;
+    value_type * max_score = buffers + 6 * stripe;
+    value_type * real_col = buffers + 7 * stripe;
+    fill(h_prev, h_prev + stripe, 0);
+    fill(f_prev, f_prev + stripe, 0);
+    fill(ext_ok, ext_ok + stripe, 0);
+    fill(max_score, max_score + stripe, 0);
+    fill(reference_maxima_, reference_maxima_ + ref_len, 0);
+    fill(query_maxima_index_, query_maxima_index_ + ref_len, 0);
+    // query profile rows that the prepared probe does not provide
+    int profile_rows = 0;
+    int profile_row[256];
+    fill(profile_row, profile_row + 256, -1);
+    // gaps only extend past the second reference position
+    for(int j = 2; j < ref_len; ++j){
+      ext_ok[(j % seg_len) * lanes + (j / seg_len)] = -1;
+    }
+    // the padding columns are left out of the row scores of X-drop
+    fill(real_col, real_col + stripe, 0);
+    for(int j = 0; j < ref_len; ++j){
+      real_col[(j % seg_len) * lanes + (j / seg_len)] = -1;
+    }
+    // read bases the probe does not contain
+    bool absent[256];
+    fill(absent, absent + 256, true);
+    for(int j = 0; j < ref_len; ++j){
+      absent[(unsigned char) reference_[j]] = false;
+    }
+    const bool skip_zero_rows = !keep_matrices and search_dist_ == 4 and zero_rows_stay_zero_();
+    bool zero_row = false;
+    int best_score = 0;
+    if(keep_matrices and first_row > 1){
+      for(int j = 0; j < ref_len; ++j){
+	int score = aln_array_[first_row - 1][j + 1];
+	if(!exact and (score > numeric_limits<value_type>::max() - step
+		       or score < numeric_limits<value_type>::min() + step)){
+	  return false;
+	}
+	h_prev[(j % seg_len) * lanes + (j / seg_len)] = score;
+	f_prev[(j % seg_len) * lanes + (j / seg_len)] = traceback_matrix_.get(first_row - 1, j + 1) != 0 ? -1 : 0;
+      }
+    }
+    const bool local_aln = (search_dist_ == 4);
+    const vec zero = V::zero();
+    const vec ones = V::cmpeq(zero, zero);
+    const vec neg_inf = V::set1(numeric_limits<value_type>::min() / 2);
+    const vec ins_open = V::set1(aln_settings_.insertion_open);
+    const vec del_open = V::set1(aln_settings_.deletion_open);
+    const vec del_ext = V::set1(aln_settings_.deletion_extend);
+    const vec trace_mismatch = V::set1(-1);
+    const vec trace_ins = V::set1(1);
+    const vec trace_del = V::set1(2);
+    const vec upper = V::set1(exact ? numeric_limits<value_type>::max() : numeric_limits<value_type>::max() - step);
+    const vec lower = V::set1(exact ? numeric_limits<value_type>::min() : numeric_limits<value_type>::min() + step);
+    for(int que_pos = first_row; que_pos <= que_len; ++que_pos){
+      unsigned char que_base = query_[que_pos - 1];
+      // the previous row is all zeros and mismatches, so is this one
+      if(zero_row and absent[que_base]){
+	continue;
+      }
+      const value_type * scores = nullptr;
+      if(prepared_probe_ != nullptr and ref_len == reference_.size()){
+	scores = prepared_probe_->profile_row<value_type>(que_base, lanes, aln_settings_.match,
+							  aln_settings_.mismatch);
+      }
+      if(scores == nullptr){
+	if(profile_row[que_base] < 0){
+	  profile_row[que_base] = profile_rows++;
+	  value_type * row_scores = workspace_.profile_buffer<value_type>(2 * stripe * profile_rows)
+	    + 2 * stripe * profile_row[que_base];
+	  striped_profile_row(reference_, ref_len, que_base, lanes, seg_len, aln_settings_.match,
+			      aln_settings_.mismatch, row_scores, row_scores + stripe);
+	}
+	scores = workspace_.profile_buffer<value_type>(2 * stripe * profile_rows)
+	  + 2 * stripe * profile_row[que_base];
+      }
+      const value_type * matches = scores + stripe;
+      const vec ins_ext = V::set1(que_pos > 2 ? aln_settings_.insertion_extend : aln_settings_.insertion_open);
+      // score one segment given the score/flag of the cells to its left
+      auto score_segment = [&](int s, vec h_left, vec f_left, vec & h, vec & f){
+	vec h_diag;
+	if(s == 0){
+	  h_diag = V::shift_in(V::load(h_prev + (seg_len - 1) * lanes), 0);
+	}
+	else{
+	  h_diag = V::load(h_prev + (s - 1) * lanes);
+	}
+	vec eq = V::load(matches + s * lanes);
+	vec diag = V::add(h_diag, V::load(scores + s * lanes));
+	vec ins = V::add(V::load(h_prev + s * lanes),
+			 V::blend(ins_open, ins_ext, V::load(f_prev + s * lanes)));
+	vec del = V::add(h_left,
+			 V::blend(del_open, del_ext, V::and_(f_left, V::load(ext_ok + s * lanes))));
+	vec ins_wins = V::cmpgt(ins, diag);
+	vec del_wins = V::cmpgt(del, diag);
+	vec off_diag = V::or_(ins_wins, del_wins);
+	f = V::or_(off_diag, V::andnot(eq, ones));
+	h = V::max(V::max(diag, ins), del);
+	if(local_aln){
+	  h = V::max(h, zero);
+	}
+	// ties go to the diagonal, then to the insertion
+	vec on_diag_trace = V::blend(trace_mismatch, zero, eq);
+	vec off_diag_trace = V::blend(trace_ins, trace_del, V::cmpgt(del, ins));
+	V::store(trace + s * lanes, V::blend(on_diag_trace, off_diag_trace, off_diag));
+      };
+      // first pass, lanes > 0 of segment 0 do not know their left neighbour yet
+      vec h_left = V::shift_in(neg_inf, 0);
+      vec f_left = zero;
+      vec h, f;
+      for(int s = 0; s < seg_len; ++s){
+	score_segment(s, h_left, f_left, h, f);
+	V::store(h_cur + s * lanes, h);
+	V::store(f_cur + s * lanes, f);
+	h_left = h;
+	f_left = f;
+      }
+      // carry the last segment into the next lane until nothing changes
+      int s = 0;
+      h_left = V::shift_in(h_left, 0);
+      f_left = V::shift_in(f_left, 0);
+      while(true){
+	score_segment(s, h_left, f_left, h, f);
+	vec same = V::and_(V::cmpeq(h, V::load(h_cur + s * lanes)),
+			   V::cmpeq(f, V::load(f_cur + s * lanes)));
+	if(!V::any(V::andnot(same, ones))){
+	  break;
+	}
+	V::store(h_cur + s * lanes, h);
+	V::store(f_cur + s * lanes, f);
+	h_left = h;
+	f_left = f;
+	if(++s == seg_len){
+	  s = 0;
+	  h_left = V::shift_in(h_left, 0);
+	  f_left = V::shift_in(f_left, 0);
+	}
+      }
+      if(!exact){
+	vec out_of_range = V::zero();
+	for(int s = 0; s < seg_len; ++s){
+	  vec h = V::load(h_cur + s * lanes);
+	  out_of_range = V::or_(out_of_range, V::or_(V::cmpgt(h, upper), V::cmpgt(lower, h)));
+	}
+	if(V::any(out_of_range)){
+	  return false;
+	}
+      }
+      if(keep_matrices){
+	// unstripe the row into the score and traceback matrices,
+	// keeping track of maxima for tracing alignments
+	for(int l = 0; l < lanes; ++l){
+	  for(int s = 0; s < seg_len; ++s){
+	    int ref_pos = l * seg_len + s;
+	    if(ref_pos >= ref_len){
+	      break;
+	    }
+	    int score = h_cur[s * lanes + l];
+	    aln_array_[que_pos][ref_pos + 1] = score;
+	    traceback_matrix_.set(que_pos, ref_pos + 1, trace[s * lanes + l]);
+	    if(score > reference_maxima_[ref_pos]){
+	      reference_maxima_[ref_pos] = score;
+	      query_maxima_index_[ref_pos] = que_pos;
+	    }
+	  }
+	}
+      }
+      else{
+	// a column maximum only rises a few times, the lanes are only
+	// visited for the segments where one did
+	vec row_best = zero;
+	vec nonzero = zero;
+	vec all_flags = ones;
+	for(int s = 0; s < seg_len; ++s){
+	  vec h = V::load(h_cur + s * lanes);
+	  if(pass_x_drop_ >= 0){
+	    row_best = V::max(row_best, V::and_(h, V::load(real_col + s * lanes)));
+	  }
+	  if(skip_zero_rows){
+	    nonzero = V::or_(nonzero, h);
+	    all_flags = V::and_(all_flags, V::load(f_cur + s * lanes));
+	  }
+	  vec best = V::load(max_score + s * lanes);
+	  if(V::any(V::cmpgt(h, best))){
+	    V::store(max_score + s * lanes, V::max(h, best));
+	    for(int l = 0; l < lanes; ++l){
+	      int ref_pos = l * seg_len + s;
+	      if(ref_pos < ref_len and h_cur[s * lanes + l] > reference_maxima_[ref_pos]){
+		reference_maxima_[ref_pos] = h_cur[s * lanes + l];
+		query_maxima_index_[ref_pos] = que_pos;
+	      }
+	    }
+	  }
+	}
+	zero_row = skip_zero_rows and !V::any(nonzero) and !V::any(V::andnot(all_flags, ones));
+	if(pass_x_drop_ >= 0){
+	  value_type lane_best[V::lanes];
+	  V::store(lane_best, row_best);
+	  int row_score = *max_element(lane_best, lane_best + lanes);
+	  best_score = max(best_score, row_score);
+	  if(x_dropped_(best_score, row_score)){
+	    swap(h_prev, h_cur);
+	    break;
+	  }
+	}
+      }
+      swap(h_prev, h_cur);
+      swap(f_prev, f_cur);
+    }
+    if(!keep_matrices){
+      // the last row, read by the search for global maxima
+      for(int ref_pos = 0; ref_pos < ref_len; ++ref_pos){
+	aln_array_[que_len][ref_pos + 1] = h_prev[(ref_pos % seg_len) * lanes + ref_pos / seg_len];
+      }
+    }
+    return true;
+  }
+#endif
+
   /////////////////////////////////////////////////////////////////////////////////////////
   // find all alignments satisfying the minimum score, filter overlaping query alignments
   /////////////////////////////////////////////////////////////////////////////////////////
@@ -306,72 +763,18 @@ class SWAligner{
   }  
   
   //////////////////////////////////////////////////////////////////
-  // filter maxima to find best alignment of the query at each loci
+  // filter maxima to find best alignment of the query at each loci,
+  // alignments are filtered if they are contained in the same query space
   //////////////////////////////////////////////////////////////////
-  vector< maxima_coords > filter_maxima_(vector< maxima_coords > maxima){
-    vector< maxima_coords > filtered_maxima;
-    //TODO: look at CLRS book, stock price algo.
-    //maximum subarray problem
-    //I should also consider to cost of a simple filter and then follow up with
-    //tracing alignment and comparing start-end points together
-    for(int i = 0; i < maxima.size(); ++i){
-      bool keep = true;
-      for(int j = 0; j < maxima.size(); ++j){
-	if( i != j){
-	  int dist = abs( (maxima[i].ref_pos - maxima[j].ref_pos) );
-	  //alignments are filtered if they are contained in the same query space.
-	  if( dist < ( query_.size() * 1.25 ) ){ 
-	    if( maxima[j].aln_score > maxima[i].aln_score ){
-	      keep = false;
-	    }
-	    else if( maxima[j].aln_score == maxima[i].aln_score ){
-	      // if two equal scoring alignments exist, choose the one farther along the query sequence
-	      if( maxima[j].query_pos > maxima[i].query_pos ){
-		keep = false;
-	      }
-	      //otherwise choose the more concise alignments
-	      else if( maxima[j].query_pos == maxima[i].query_pos ){
-		if(maxima[j].ref_pos < maxima[i].ref_pos){
-		  keep = false;
-		}
-	      }	      
-	    }
-	  }
-	}
-      }
-      if(keep){
-	filtered_maxima.push_back(maxima[i]);
-      }
-    }
-    return filtered_maxima;
- }
-
-  ////////////////////////////////////////
-  // make a cigar from the traceback map
-  ////////////////////////////////////////
-  string cigar_compress_(string map){
-    string cigar;
-    int counter = 1;
-    for(int cig = 0; cig < map.size(); ++ cig){
-      if(map[cig]==map[cig+1]){
-        counter = counter + 1;
-      }
-      else{
-        string count, letter;
-        count = to_string(counter);
-        letter = map[cig];
-        cigar = cigar.append(count);
-        cigar = cigar.append(letter);
-        counter = 1;
-      }
-    }
-    return cigar;
+  vector< maxima_coords > filter_maxima_(const vector< maxima_coords > & maxima){
+    return filter_overlapping_maxima(maxima, query_.size() * 1.25);
   }
-  
+
   /////////////////////////////////////////////////////
   // traceback the alignment from some given position
   /////////////////////////////////////////////////////
-  // if global is true, add arguments for 
+  // the cigar is built end first as runs in the workspace buffer and
+  // reversed into the report once the start is reached
   void trace_alignment_(maxima_coords position, alignment_report * aln_report){
     if(debug_){
       cerr << "trace alignment" << endl;
@@ -380,45 +783,36 @@ class SWAligner{
     int que_pos = position.query_pos;
     aln_report->reference_end = ref_pos;
     aln_report->query_end = que_pos;
-    string cigar_values;
+    vector< uint32_t > & cigar = workspace_.cigar_buffer();
     int trace_end = 0;
     int edit_dist = 0;
     // soft clip end if necessary
-    if(que_pos != query_.size()){
-      for(int i = 0; i < (query_.size() - que_pos); ++i){
-	cigar_values = cigar_values.insert(0, "S");
-      }
-    }
+    push_cigar_op(cigar, CIGAR_SOFT_CLIP, query_.size() - que_pos);
     if(debug_){
       cerr << "tracing alignment" << endl;
     }
     while(trace_end < 1) {
+      load_trace_rows_(que_pos);
       // 0 diag, 1 que, 2 ref
-      int direction = traceback_matrix_[que_pos][ref_pos];
-      // TODO: use a switch/case/default construct here
-      /*
-	if(debug_){
-	cerr << "q= " << que_pos << " r=" << ref_pos << endl;
-      }
-      */
+      int direction = traceback_matrix_.get(que_pos, ref_pos);
       if(direction <= 0) {
 	que_pos = que_pos - 1;
 	ref_pos = ref_pos - 1;
 	if(direction == 0){
-	  cigar_values = cigar_values.insert(0, "M");
+	  push_cigar_op(cigar, CIGAR_MATCH);
 	}
 	else{
-	  cigar_values = cigar_values.insert(0, "X");
+	  push_cigar_op(cigar, CIGAR_MISMATCH);
 	  ++edit_dist;
 	}
       }
       else if(direction == 1){
-	cigar_values = cigar_values.insert(0, "I");
+	push_cigar_op(cigar, CIGAR_INSERTION);
 	que_pos = que_pos - 1;
 	++edit_dist;
       }
       else if(direction == 2){
-	cigar_values = cigar_values.insert(0, "D");
+	push_cigar_op(cigar, CIGAR_DELETION);
 	ref_pos = ref_pos - 1;
 	++edit_dist;
       }
@@ -437,13 +831,8 @@ class SWAligner{
       }
     }
     //soft clip the beginning if necessary
-    if(que_pos != 0){
-      for(int i = 0; i < que_pos; ++i){
-	cigar_values = cigar_values.insert(0, "S");
-      }
-    }
-    aln_report->cigar_values = cigar_values;
-    aln_report->cigar = cigar_compress_(cigar_values);
+    push_cigar_op(cigar, CIGAR_SOFT_CLIP, que_pos);
+    aln_report->cigar_ops.assign(cigar.rbegin(), cigar.rend());
     aln_report->aln_score = position.aln_score;
     aln_report->edit_distance = edit_dist;
     if(debug_){
@@ -452,24 +841,19 @@ class SWAligner{
     }
   }
   
-  //////////////////////////////////////////////////////
-  // de-allocate memory for alignment/traceback arrays
-  //////////////////////////////////////////////////////
-  void delete_allocations_(){
-    for(int i = 0; i < (query_.size()+1); ++i){
-      delete aln_array_[i];
-      delete traceback_matrix_[i];
-    }
-    delete aln_array_;
-    delete traceback_matrix_;
-    delete [] query_maxima_index_;
-    delete [] reference_maxima_;
-  }
-
   ////////////////////////////////////////////////////////////////////
   //  a function to print either the alignment or traceback matrix
   ////////////////////////////////////////////////////////////////////
-  void show_matrix_(int ** allocated_matrix_){
+  int matrix_cell_(int ** allocated_matrix_, int que_pos, int ref_pos){
+    return allocated_matrix_[que_pos][ref_pos];
+  }
+
+  int matrix_cell_(const TracebackMatrix & allocated_matrix_, int que_pos, int ref_pos){
+    return allocated_matrix_.get(que_pos, ref_pos);
+  }
+
+  template <class Matrix>
+  void show_matrix_(const Matrix & allocated_matrix_){
     //print the query sequence
     cerr << endl;
     cerr << "    -  ";
@@ -490,7 +874,7 @@ class SWAligner{
       }
       cerr << refScore << "  ";
       while(que_pos <= query_.size()){
-	val = allocated_matrix_[que_pos][ref_pos];
+	val = matrix_cell_(allocated_matrix_, que_pos, ref_pos);
 	if(val < 10 ){
 	  if(val < 0){
 	    cerr << val << " ";
@@ -529,14 +913,14 @@ class SWAligner{
     if(debug_){
       cerr << "show alignment" << endl;
     }
-    string cig = aln_report->cigar_values;
+    string cig = expanded_cigar(aln_report->cigar_ops);
     cerr << "reference name= " << aln_report->reference_name << endl;
     cerr << "reference start= " << aln_report->reference_start << endl;
     cerr << "reference end= " << aln_report->reference_end << endl;
     cerr << "query start= " << aln_report->query_start << endl;
     cerr << "query end= " << aln_report->query_end << endl;
     cerr << "strand= " << aln_report->strand << endl;
-    cerr << "cigar= " << aln_report->cigar << endl;
+    cerr << "cigar= " << cigar_string(aln_report->cigar_ops) << endl;
     cerr << "alignment score= " << aln_report->aln_score << endl;
 
     //look at the barcode
@@ -644,7 +1028,7 @@ class SWAligner{
       string rc = reverse_complement_(query->get_sequence()); 
       query_ = rc;
     }
-    run_sw_(query, read, alignments, 0, ref_len);
+    run_sw_(query->get_read_id(), read->get_read_id(), alignments, 0, ref_len);
   }
 
   void sw_alignment_begin_(shared_ptr< MutableAlignment > query,
@@ -674,9 +1058,222 @@ class SWAligner{
       string rc = reverse_complement_(query->get_sequence()); 
       query_ = rc;
     }
-    run_sw_(query, read, alignments, 0, ref_len);
+    run_sw_(query->get_read_id(), read->get_read_id(), alignments, 0, ref_len);
   }
 
+  ////////////////////////////////////////////////////////////////////
+  // keep the sequence and reverse complement of the read being
+  // aligned, so they are built once per read rather than per probe
+  ////////////////////////////////////////////////////////////////////
+  void cache_read_(const shared_ptr< MutableAlignment > & read){
+    if(read != cached_read_){
+      cached_read_ = read;
+      read_forward_ = read->get_sequence();
+      read_reverse_ = reverse_complement_(read_forward_);
+    }
+  }
+
+  void sw_alignment_prepared_(const string & read_name,
+			      const string & read_sequence,
+			      const PreparedProbe & probe,
+			      string strand, bool global_aln,
+			      shared_ptr< vector<alignment_report> > & alignments,
+			      const set<int> & diagonals){
+    global_aln_ = global_aln;
+    strand_ = strand;
+    if(global_aln_){
+      search_dist_ = 3;
+    }
+    else{
+      search_dist_ = 4;
+    }
+    if(debug_){
+      cerr << "smith waterman alignment on strand:" << strand << endl;
+    }
+    // local alignments need the probe within a few edits of the read
+    if(!global_aln and !probe.may_align(read_sequence)){
+      return;
+    }
+    query_ = read_sequence;
+    reference_ = probe.sequence();
+    prepared_probe_ = &probe;
+    vector< pair<int, int> > windows;
+    if(use_windows_(global_aln, diagonals)){
+      windows = seed_windows_(diagonals, read_sequence.size());
+    }
+    int window_len = 0;
+    for(auto & window : windows){
+      window_len += window.second - window.first;
+    }
+    // fall back to the full read when the windows would cover it anyway
+    if(!windows.empty() and window_len < read_sequence.size()){
+      run_sw_windows_(read_name, probe.name(), read_sequence, windows, alignments);
+    }
+    else{
+      run_sw_(read_name, probe.name(), alignments, 0, reference_.size());
+    }
+    prepared_probe_ = nullptr;
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // seed windows apply to local alignments with at least one seed,
+  // global alignments have to reach the end of the read
+  ////////////////////////////////////////////////////////////////////
+  bool use_windows_(bool global_aln, const set<int> & diagonals){
+    return band_width_ >= 0 and !global_aln and !diagonals.empty();
+  }
+
+#if SWIFR_SIMD
+  //////////////////////////////////////////////////////////////////////////
+  // score one probe against up to V::lanes reads at once, one read per
+  // lane, following the recurrence of calc_score_/trace_position_ cell by
+  // cell. Nothing is kept but the best score a read could report: the
+  // column maxima for local alignments, the last row for global ones.
+  // has_hit[i] is false when read i cannot reach the minimum alignment
+  // score, saturated[i] is set when its scores came close to the limits
+  // of value_type, in which case has_hit[i] means nothing.
+  //////////////////////////////////////////////////////////////////////////
+  template <class V>
+  void score_batch_(const vector< const string * > & reads, vector< bool > & has_hit,
+		    vector< bool > & saturated){
+    typedef typename V::vec vec;
+    typedef typename V::value_type value_type;
+    const int lanes = V::lanes;
+    const int ref_len = reference_.size();
+    const int count = reads.size();
+    const int step = score_step_();
+    has_hit.assign(count, false);
+    saturated.assign(count, false);
+    // padding past the end of a read must never match the probe
+    bool in_probe[256] = {false};
+    for(int r = 0; r < ref_len; ++r){
+      in_probe[(unsigned char) reference_[r]] = true;
+    }
+    int pad = 0;
+    while(pad < 256 and in_probe[pad]){
+      ++pad;
+    }
+    if(pad == 256 or 2 * step >= numeric_limits<value_type>::max()){
+      saturated.assign(count, true);
+      return;
+    }
+    int max_len = 0;
+    int lengths[lanes];
+    for(int l = 0; l < lanes; ++l){
+      lengths[l] = (l < count) ? reads[l]->size() : 0;
+      max_len = max(max_len, lengths[l]);
+    }
+    // read bases transposed to one row per query position, with the rows
+    // of the masks telling which lanes are inside or at the end of a read
+    value_type * buffers = workspace_.kernel_buffer<value_type>(lanes * (3 * max_len + 2 * (ref_len + 1)));
+    value_type * bases = buffers;
+    value_type * in_read_rows = bases + lanes * max_len;
+    value_type * last_rows = in_read_rows + lanes * max_len;
+    value_type * h_row = last_rows + lanes * max_len;
+    value_type * f_row = h_row + lanes * (ref_len + 1);
+    for(int q = 0; q < max_len; ++q){
+      for(int l = 0; l < lanes; ++l){
+	int k = q * lanes + l;
+	bases[k] = (value_type) (unsigned char) ((q < lengths[l]) ? (*reads[l])[q] : pad);
+	in_read_rows[k] = (q < lengths[l]) ? -1 : 0;
+	last_rows[k] = (q == lengths[l] - 1) ? -1 : 0;
+      }
+    }
+    fill(h_row, h_row + lanes * (ref_len + 1), 0);
+    fill(f_row, f_row + lanes * (ref_len + 1), 0);
+    // keep one full step of headroom on both sides of the saturating adds
+    const vec upper = V::set1(numeric_limits<value_type>::max() - step);
+    const vec lower = V::set1(numeric_limits<value_type>::min() + step);
+    const bool local_aln = (search_dist_ == 4);
+    const vec zero = V::zero();
+    const vec ones = V::cmpeq(zero, zero);
+    const vec match = V::set1(aln_settings_.match);
+    const vec mismatch = V::set1(aln_settings_.mismatch);
+    const vec ins_open = V::set1(aln_settings_.insertion_open);
+    const vec del_open = V::set1(aln_settings_.deletion_open);
+    const vec del_ext = V::set1(aln_settings_.deletion_extend);
+    vec best = V::set1(numeric_limits<value_type>::min());
+    vec out_of_range = zero;
+    for(int q = 0; q < max_len; ++q){
+      const vec que_base = V::load(bases + q * lanes);
+      const vec ins_ext = V::set1(q + 1 > 2 ? aln_settings_.insertion_extend : aln_settings_.insertion_open);
+      const vec in_read = V::load(in_read_rows + q * lanes);
+      vec h_diag = zero;
+      vec h_left = zero;
+      vec f_left = zero;
+      vec row_max = V::set1(numeric_limits<value_type>::min());
+      vec row_out_of_range = zero;
+      for(int r = 1; r <= ref_len; ++r){
+	vec h_up = V::load(h_row + r * lanes);
+	vec f_up = V::load(f_row + r * lanes);
+	vec eq = V::cmpeq(que_base, V::set1((value_type) (unsigned char) reference_[r - 1]));
+	vec diag = V::add(h_diag, V::blend(mismatch, match, eq));
+	vec ins = V::add(h_up, V::blend(ins_open, ins_ext, f_up));
+	vec del = V::add(h_left, r > 2 ? V::blend(del_open, del_ext, f_left) : del_open);
+	vec f = V::or_(V::or_(V::cmpgt(ins, diag), V::cmpgt(del, diag)), V::andnot(eq, ones));
+	vec h = V::max(V::max(diag, ins), del);
+	if(local_aln){
+	  h = V::max(h, zero);
+	}
+	row_out_of_range = V::or_(row_out_of_range, V::or_(V::cmpgt(h, upper), V::cmpgt(lower, h)));
+	row_max = V::max(row_max, h);
+	V::store(h_row + r * lanes, h);
+	V::store(f_row + r * lanes, f);
+	h_diag = h_up;
+	h_left = h;
+	f_left = f;
+      }
+      out_of_range = V::or_(out_of_range, V::and_(row_out_of_range, in_read));
+      if(local_aln){
+	best = V::blend(best, V::max(best, row_max), in_read);
+      }
+      else{
+	best = V::blend(best, row_max, V::load(last_rows + q * lanes));
+      }
+    }
+    value_type best_scores[lanes];
+    value_type saturated_lanes[lanes];
+    V::store(best_scores, best);
+    V::store(saturated_lanes, out_of_range);
+    for(int l = 0; l < count; ++l){
+      saturated[l] = saturated_lanes[l] != 0;
+      has_hit[l] = best_scores[l] >= aln_settings_.min_aln_score;
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // run the lane-per-read pass of width V over the reads in pending,
+  // settling has_hit for them. Returns the reads that saturated and
+  // need a wider pass.
+  //////////////////////////////////////////////////////////////////////
+  template <class V>
+  vector< int > prefilter_batch_(const vector< const PreparedRead * > & reads,
+				 const vector< int > & pending, const string & strand,
+				 vector< bool > & has_hit){
+    vector< int > saturated_reads;
+    vector< const string * > batch;
+    vector< bool > batch_hit;
+    vector< bool > batch_saturated;
+    for(int p = 0; p < pending.size(); p += V::lanes){
+      int end = min((int) pending.size(), p + V::lanes);
+      batch.clear();
+      for(int b = p; b < end; ++b){
+	batch.push_back(&reads[pending[b]]->sequence(strand));
+      }
+      score_batch_<V>(batch, batch_hit, batch_saturated);
+      for(int b = p; b < end; ++b){
+	if(batch_saturated[b - p]){
+	  saturated_reads.push_back(pending[b]);
+	}
+	else{
+	  has_hit[pending[b]] = batch_hit[b - p];
+	}
+      }
+    }
+    return saturated_reads;
+  }
+#endif
+
   void sw_trim_(shared_ptr< MutableAlignment > query,
   		shared_ptr<MutableAlignment> read,
   		string strand, bool global_aln, int trim_len,
@@ -697,23 +1294,55 @@ class SWAligner{
     int ref_len = ref_seq.size();
     if(2*trim_len < ref_seq.size()){
       reference_ = ref_seq.substr(0, trim_len);
-      run_sw_(query, read, alignments, 0, ref_len);
+      run_sw_(query->get_read_id(), read->get_read_id(), alignments, 0, ref_len);
       reference_ = ref_seq.substr(ref_len-trim_len, trim_len);
-      run_sw_(query, read, alignments, ref_len-trim_len, ref_len);
+      run_sw_(query->get_read_id(), read->get_read_id(), alignments, ref_len-trim_len, ref_len);
     }
     else{
       reference_ = ref_seq;
-      run_sw_(query, read, alignments, 0, ref_len);
+      run_sw_(query->get_read_id(), read->get_read_id(), alignments, 0, ref_len);
     }
   }
 
-  void run_sw_(shared_ptr< MutableAlignment > query,
-  	       shared_ptr<MutableAlignment> read,
+  ////////////////////////////////////////////////////////////////////
+  // fill the matrices, in full or as a score-only pass that keeps no
+  // more than two rows of them
+  ////////////////////////////////////////////////////////////////////
+  void score_pass_(int que_len, int ref_len, bool keep_matrices, int first_row = 1){
+    if(use_simd_){
+      score_matrices_simd_(que_len, ref_len, keep_matrices, first_row);
+    }
+    else{
+      score_matrices_(que_len, ref_len, first_row);
+    }
+  }
+
+  void run_sw_(const string & query_name,
+	       const string & reference_name,
   	       shared_ptr< vector<alignment_report> > & alignments,
   	       int adj_pos, int ref_len){
-    // perform key alignment steps 
-    allocate_memory_();
-    score_matrices_();    
+    // perform key alignment steps, the score-only pass finds the maxima
+    // and the traceback pass rescores only the top-left corner of the
+    // matrices that ends at the last of them
+    prepare_score_pass_();
+    score_pass_(query_.size(), reference_.size(), false);
+    vector< maxima_coords > maxima;
+    if(global_aln_){
+      maxima = find_global_maxima_();
+    }
+    else{
+      maxima = find_local_maxima_();
+    }
+    if(maxima.empty()){
+      return;
+    }
+    int trace_rows = 0;
+    int trace_cols = 0;
+    for(auto & max_pos : maxima){
+      trace_rows = max(trace_rows, max_pos.query_pos);
+      trace_cols = max(trace_cols, max_pos.ref_pos);
+    }
+    traceback_pass_(trace_rows, trace_cols);
     /*
     if(debug_){
       show_scores_();
@@ -722,28 +1351,100 @@ class SWAligner{
       show_maxima_index_();
     }
     */
-    vector< maxima_coords > maxima;
-    if(global_aln_){
-      maxima = find_global_maxima_();
+    for (auto & max_pos : maxima){
+      alignments->push_back(report_alignment_(max_pos, query_name, reference_name, adj_pos, ref_len));
     }
-    else{
-      maxima = find_local_maxima_();
+  }
+
+  alignment_report report_alignment_(maxima_coords max_pos,
+				     const string & query_name,
+				     const string & reference_name,
+				     int adj_pos, int ref_len){
+    alignment_report alignment;
+    alignment.strand = strand_;
+    alignment.aln_score = max_pos.aln_score;
+    alignment.query_end = max_pos.query_pos;
+    alignment.reference_name = reference_name;
+    alignment.query_name = query_name;
+    trace_alignment_(max_pos, &alignment);
+    alignment.reference_start = alignment.reference_start + adj_pos;
+    alignment.reference_end = alignment.reference_end + adj_pos;
+    alignment.query_end = alignment.query_end + adj_pos;
+    alignment.reference_length = ref_len;
+    return alignment;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // read windows around the seed diagonals: a seed on diagonal d puts
+  // the probe at read positions d .. d + |probe|, which is padded by
+  // the band width on both sides. Overlapping windows are merged.
+  //////////////////////////////////////////////////////////////////////
+  vector< pair<int, int> > seed_windows_(const set<int> & diagonals, int read_len){
+    vector< pair<int, int> > windows;
+    const int probe_len = reference_.size();
+    for(int diagonal : diagonals){
+      int start = max(0, diagonal - band_width_);
+      int end = min(read_len, diagonal + probe_len + band_width_);
+      if(start >= end){
+	continue;
+      }
+      if(!windows.empty() and start <= windows.back().second){
+	windows.back().second = max(windows.back().second, end);
+      }
+      else{
+	windows.push_back(make_pair(start, end));
+      }
     }
-    for (auto & max_pos : maxima){
-      alignment_report alignment;
-      alignment.strand = strand_;
-      alignment.aln_score = max_pos.aln_score;
-      alignment.query_end = max_pos.query_pos;
-      alignment.reference_name = read->get_read_id();
-      alignment.query_name = query->get_read_id();
-      trace_alignment_(max_pos, &alignment);
-      alignment.reference_start = alignment.reference_start + adj_pos;
-      alignment.reference_end = alignment.reference_end + adj_pos;
-      alignment.query_end = alignment.query_end + adj_pos;
-      alignment.reference_length = ref_len;
-      alignments->push_back(alignment);      
-    }
-    delete_allocations_();
+    return windows;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // local alignment of the probe against the given read windows only.
+  // The column maxima are combined over the windows as if the rows in
+  // between did not exist, at their read rows, so the maxima are
+  // searched and filtered as for a full read; each surviving maximum is
+  // then traced inside its own window and reported in read coordinates.
+  //////////////////////////////////////////////////////////////////////
+  void run_sw_windows_(const string & query_name,
+		       const string & reference_name,
+		       const string & read_sequence,
+		       const vector< pair<int, int> > & windows,
+		       shared_ptr< vector<alignment_report> > & alignments){
+    const int ref_len = reference_.size();
+    int * maxima_score = workspace_.window_maxima(ref_len);
+    int * maxima_index = workspace_.window_maxima_index(ref_len);
+    int * maxima_source = workspace_.window_maxima_source(ref_len);
+    for(int w = 0; w < windows.size(); ++w){
+      query_ = read_sequence.substr(windows[w].first, windows[w].second - windows[w].first);
+      prepare_score_pass_();
+      pass_x_drop_ = x_drop_;
+      score_pass_(query_.size(), ref_len, false);
+      pass_x_drop_ = -1;
+      for(int j = 0; j < ref_len; ++j){
+	if(reference_maxima_[j] > maxima_score[j]){
+	  maxima_score[j] = reference_maxima_[j];
+	  maxima_index[j] = query_maxima_index_[j] + windows[w].first;
+	  maxima_source[j] = w;
+	}
+      }
+    }
+    query_ = read_sequence;
+    reference_maxima_ = maxima_score;
+    query_maxima_index_ = maxima_index;
+    vector< maxima_coords > maxima = find_local_maxima_();
+    for(auto max_pos : maxima){
+      const pair<int, int> & window = windows[maxima_source[max_pos.ref_pos - 1]];
+      query_ = read_sequence.substr(window.first, window.second - window.first);
+      max_pos.query_pos -= window.first;
+      traceback_pass_(max_pos.query_pos, max_pos.ref_pos);
+      alignment_report alignment = report_alignment_(max_pos, query_name, reference_name, 0, ref_len);
+      // soft clip the read outside of the window
+      alignment.query_start += window.first;
+      alignment.query_end += window.first;
+      add_soft_clips(alignment.cigar_ops, window.first, read_sequence.size() - window.second);
+      alignments->push_back(alignment);
+    }
+    query_ = read_sequence;
   }
   
   void show_scores_(){
@@ -773,6 +1474,48 @@ class SWAligner{
   SWAligner(alignment_parameters command_line_input, bool debug){
     aln_settings_ = command_line_input;
     debug_ = debug;
+    use_simd_ = true;
+    band_width_ = -1;
+    trace_cell_limit_ = DEFAULT_TRACE_CELL_LIMIT;
+    block_rows_ = 0;
+    x_drop_ = -1;
+    pass_x_drop_ = -1;
+    prepared_probe_ = nullptr;
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // tracebacks covering more matrix cells than this keep checkpoint
+  // rows instead of the full matrices, so their memory stays close
+  // to linear in the read length
+  //////////////////////////////////////////////////////////////////
+  void set_trace_cell_limit(long cells){
+    trace_cell_limit_ = cells;
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // stop scoring a seed window once the probe has matched and the
+  // scores of a read position fall more than x_drop below the best
+  // one in the window. A negative x_drop scores whole windows.
+  //////////////////////////////////////////////////////////////////
+  void set_x_drop(int x_drop){
+    x_drop_ = x_drop;
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // restrict local alignments to read windows around the seed
+  // diagonals, padded by band_width on each side. A negative band
+  // width aligns against the whole read.
+  //////////////////////////////////////////////////////////////////
+  void set_band_width(int band_width){
+    band_width_ = band_width;
+  }
+
+  //////////////////////////////////////////////////////////////////
+  // toggle the vectorized scoring kernel, the scalar loop is kept
+  // as a fallback and as a reference for testing
+  //////////////////////////////////////////////////////////////////
+  void use_simd(bool enabled){
+    use_simd_ = enabled;
   }
 
   ////////////////////////////////////////////////////
@@ -797,6 +1540,82 @@ class SWAligner{
     sw_alignment_begin_(query, read, strand, global_aln, alignments, aln_len);
   }
 
+  ////////////////////////////////////////////////////////////////
+  // align a prepared probe against one strand of the read, using
+  // the probe's precomputed profile and the cached read sequence.
+  // Seed diagonals from the kmer index limit the alignment to the
+  // read windows around them (see set_band_width).
+  ////////////////////////////////////////////////////////////////
+  void align_strand(shared_ptr< MutableAlignment > read,
+		    const PreparedProbe & probe,
+		    bool global_aln,
+		    shared_ptr< vector<alignment_report> > alignments,
+		    string strand,
+		    const set<int> & diagonals = set<int>()){
+    cache_read_(read);
+    const string & sequence = (strand == "-") ? read_reverse_ : read_forward_;
+    sw_alignment_prepared_(read->get_read_id(), sequence, probe, strand, global_aln, alignments,
+			   diagonals);
+  }
+
+  void align_strand(const PreparedRead & read,
+		    const PreparedProbe & probe,
+		    bool global_aln,
+		    shared_ptr< vector<alignment_report> > alignments,
+		    string strand,
+		    const set<int> & diagonals = set<int>()){
+    sw_alignment_prepared_(read.name(), read.sequence(strand), probe, strand, global_aln, alignments,
+			   diagonals);
+  }
+
+  ////////////////////////////////////////////////////////////////////
+  // align one prepared probe against a batch of reads on one strand,
+  // alignments[i] receives the same reports align_strand would give
+  // for reads[i] and its seed diagonals[i]. Short probes leave most of
+  // a striped vector empty, so the reads share the vector instead: a
+  // lane-per-read pass finds the reads that can reach the minimum
+  // score and only those are traced by the single read aligner. Reads
+  // too many edits away from the probe never enter that pass, reads
+  // aligned inside seed windows skip it, their windows are cheaper
+  // than a full read.
+  ////////////////////////////////////////////////////////////////////
+  void align_batch(const vector< const PreparedRead * > & reads,
+		   const vector< const set<int> * > & diagonals,
+		   const PreparedProbe & probe,
+		   bool global_aln,
+		   vector< shared_ptr< vector<alignment_report> > > & alignments,
+		   string strand){
+    vector< bool > has_hit(reads.size(), true);
+    // local alignments need the probe within a few edits of the read
+    if(!global_aln){
+      for(int i = 0; i < reads.size(); ++i){
+	has_hit[i] = probe.may_align(reads[i]->sequence(strand));
+      }
+    }
+#if SWIFR_SIMD
+    if(use_simd_ and aln_settings_.min_aln_score > 0){
+      global_aln_ = global_aln;
+      search_dist_ = global_aln ? 3 : 4;
+      reference_ = probe.sequence();
+      vector< int > pending;
+      for(int i = 0; i < reads.size(); ++i){
+	if(has_hit[i] and !use_windows_(global_aln, *diagonals[i])){
+	  pending.push_back(i);
+	}
+      }
+      // 8-bit lanes first, reads that saturate them are redone at 16 bits
+      // and whatever saturates those is left to the exact aligner
+      pending = prefilter_batch_<simd_int8>(reads, pending, strand, has_hit);
+      prefilter_batch_<simd_int16>(reads, pending, strand, has_hit);
+    }
+#endif
+    for(int i = 0; i < reads.size(); ++i){
+      if(has_hit[i]){
+	align_strand(*reads[i], probe, global_aln, alignments[i], strand, *diagonals[i]);
+      }
+    }
+  }
+
   void trim(shared_ptr< MutableAlignment > query,
 	    shared_ptr<MutableAlignment> read,
 	    bool global_aln, int trim_len,
@@ -830,10 +1649,9 @@ class SWAligner{
   //     query_ = reverse_complement_(query);
   //   }
   //   int max_aln_score;
-  //   allocate_memory_();
+  //   prepare_workspace_();
   //   score_matrices_();
   //   max_aln_score = max_alignment_score_();
-  //   delete_allocations_();
   //   return max_aln_score;
   // }
 
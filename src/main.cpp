@@ -37,6 +37,10 @@
 #include "alignment_reporter.hpp"
 #include "compare_aln_scores.hpp"
 #include "kmer_index.hpp"
+#include "index_file.hpp"
+#include "prepared_probe.hpp"
+#include "prepared_read.hpp"
+#include "exact_matcher.hpp"
 //reporting
 #include "basename.hpp"
 #include "write_aln_report.hpp"
@@ -52,74 +56,94 @@ mutex resultBarrier;
 
 typedef shared_ptr< MutableAlignment > shared_read_ptr;
 //typedef tuple <shared_ptr< MutableAlignment >,char> indexType;
-typedef tuple <shared_ptr< MutableAlignment >,char, set<int>> indexType;
-typedef shared_ptr< KmerIndex > index_ptr;
+typedef tuple <shared_ptr< MutableAlignment >,char, set<int>, int> indexType;
+typedef shared_ptr< const KmerIndex > index_ptr;
+typedef shared_ptr< const ProbeSet > probe_set_ptr;
+typedef shared_ptr< const ExactMatcher > exact_matcher_ptr;
+
+// reads taken off the queue by a thread at a time
+const int READ_BATCH_SIZE = 64;
 
 void do_work(input_parameters ip,
-	     shared_read_ptr read_ptr,
+	     vector< shared_read_ptr > reads,
+	     SWAligner & aligner,
 	     index_ptr queryIndex,
+	     KmerSearchContext & kmerContext,
+	     probe_set_ptr probeSet,
+	     exact_matcher_ptr exactMatcher,
 	     AlignmentReporter reporter,
 	     shared_ptr< vector<alignment_report> > queryHits,
 	     shared_ptr< int > counter,
 	     shared_ptr< int > workCounter,
 	     shared_ptr< int > alnCounter){
   
-  SWAligner aligner(ip.align_params, ip.debug_mode);
-  shared_ptr< vector<alignment_report> > query_alignments(new vector< alignment_report >());
+  vector< PreparedRead > prepared_reads;
+  vector< vector< indexType > > filtQueries(reads.size());
+  vector< shared_ptr< vector<alignment_report> > > read_alignments;
 
-  vector< indexType > filtQuery;
+  for(int i = 0; i < reads.size(); ++i){
+    shared_read_ptr read_ptr = reads[i];
+    prepared_reads.push_back(PreparedRead(read_ptr));
+    read_alignments.push_back(shared_ptr< vector<alignment_report> >(new vector< alignment_report >()));
 
-  // first check for exact match
+    vector< indexType > & filtQuery = filtQueries[i];
     
-  // returning a smaller set of probes to align the read against
-  if(read_ptr->get_sequence().size() > ip.kmer_size+5){
+    // returning a smaller set of probes to align the read against
+    if(read_ptr->get_sequence().size() > ip.kmer_size+5){
 
-    if(ip.kmer_size > 0){
-      filtQuery = queryIndex->filter_by_kmers(read_ptr->get_sequence(), false);
-    }
-    //pass all seqs in +/- orientation
-    else{
-      filtQuery = queryIndex->all_seqs();
-    }
-    
-    if(filtQuery.size() == 0 && ip.complete_search){
-      filtQuery = queryIndex->all_seqs();
-    }
-    
-    int aln_len = read_ptr->get_sequence().size();
-    
-    if(ip.aln_len > 0){
-      if(aln_len > ip.aln_len){
-	aln_len = ip.aln_len;
+      if(ip.kmer_size > 0){
+	// reads with no kmer in any query seq skip the kmer search
+	if(queryIndex->may_match(read_ptr->get_sequence())){
+	  filtQuery = queryIndex->filter_by_kmers(read_ptr->get_sequence(), false, kmerContext);
+	}
+      }
+      //pass all seqs in +/- orientation
+      else{
+	filtQuery = queryIndex->all_seqs();
       }
-    }
     
-    // align probes to reads
-    if(filtQuery.size() > 0){
-      align_primers(ip, aligner, read_ptr,
-		    filtQuery, query_alignments, 
-		    aln_len);
+      if(filtQuery.size() == 0 && ip.complete_search){
+	filtQuery = queryIndex->all_seqs();
+      }
+
+      // exact matches of the candidates first, probes matched in full
+      // on a strand are not aligned there
+      if(!ip.global_alignment){
+	set< pair<int, char> > exactProbes;
+	exactMatcher->find_matches(prepared_reads.back(), candidate_strands(*probeSet, filtQuery),
+				   *read_alignments.back(), exactProbes);
+	drop_matched_candidates(*probeSet, exactProbes, filtQuery);
+      }
     }
-  }  
+  }
+
+  // align probes to reads, reads sharing a probe are aligned together
+  align_primers_batch(ip, aligner, prepared_reads, filtQueries,
+		      *probeSet, read_alignments);
+
   //prevent collisions in reporting
   resultBarrier.lock();
   
-  //store alignments in table
-  *workCounter = *workCounter + query_alignments->size();   
-  if( query_alignments->size() > 0){
-    *alnCounter = *alnCounter + 1;   
-  }
-  reporter.report_alignments(query_alignments, read_ptr);
+  for(int i = 0; i < reads.size(); ++i){
+    shared_ptr< vector<alignment_report> > query_alignments = read_alignments[i];
 
-  //keep track of count
-  *counter = *counter + 1;
-  if(ip.verbose == true){
-    if(*counter % 1000 == 0){
-      if(*counter == 1000){
-	cerr << "aligned " << *counter/1000 << "K"; 
-      }
-      else{
-	cerr << "\r" << "aligned " << *counter/1000 << "K";
+    //store alignments in table
+    *workCounter = *workCounter + query_alignments->size();   
+    if( query_alignments->size() > 0){
+      *alnCounter = *alnCounter + 1;   
+    }
+    reporter.report_alignments(query_alignments, reads[i]);
+
+    //keep track of count
+    *counter = *counter + 1;
+    if(ip.verbose == true){
+      if(*counter % 1000 == 0){
+	if(*counter == 1000){
+	  cerr << "aligned " << *counter/1000 << "K"; 
+	}
+	else{
+	  cerr << "\r" << "aligned " << *counter/1000 << "K";
+	}
       }
     }
   }
@@ -130,6 +154,8 @@ void do_work(input_parameters ip,
 void consumer(input_parameters ip,
 	      shared_ptr< vector < shared_read_ptr > > read_queue,
 	      index_ptr queryIndex,
+	      probe_set_ptr probeSet,
+	      exact_matcher_ptr exactMatcher,
 	      AlignmentReporter reporter,
 	      shared_ptr< vector<alignment_report> > queryHits,
 	      shared_ptr< bool> has_data,
@@ -137,6 +163,15 @@ void consumer(input_parameters ip,
 	      shared_ptr< int > workCounter,
 	      shared_ptr< int > alnCounter){
   
+  // one aligner per thread, its workspace is reused for every read
+  SWAligner aligner(ip.align_params, ip.debug_mode);
+  aligner.set_band_width(ip.band_width);
+  aligner.set_trace_cell_limit(ip.trace_cells);
+  aligner.set_x_drop(ip.x_drop);
+  // kmer counting scratch, the index itself is shared
+  KmerSearchContext kmerContext;
+  vector< shared_read_ptr > reads;
+
   //////////////////////////////////////////////////////
   // wait for reads in queue, break when queue is empty 
   //////////////////////////////////////////////////////
@@ -144,10 +179,14 @@ void consumer(input_parameters ip,
     readBarrier.lock(); // prevent collisions
     if(*has_data){
       if(!read_queue->empty()){
-	shared_ptr<MutableAlignment> read = read_queue->back();
-	read_queue->pop_back();
+	// take several reads at once so reads sharing a probe can be batched
+	reads.clear();
+	while(!read_queue->empty() and reads.size() < READ_BATCH_SIZE){
+	  reads.push_back(read_queue->back());
+	  read_queue->pop_back();
+	}
 	readBarrier.unlock(); // concurrently align reads
-	do_work(ip, read, queryIndex, reporter,
+	do_work(ip, reads, aligner, queryIndex, kmerContext, probeSet, exactMatcher, reporter,
 		queryHits, counter, workCounter, alnCounter);
 
       }
@@ -170,13 +209,27 @@ int main(int argc, char * argv []) {
   //////////////////////////////////  
   ArgParser arg_parser(argc, argv);
   input_parameters ip = arg_parser.parse_arguments();
+
+  //////////////////////////////////////////////////
+  // swifr index: save the query seqs and their index
+  //////////////////////////////////////////////////
+  if(ip.build_index){
+    vector< shared_read_ptr > query_seqs = import_fasta(ip.query_path);
+    cerr << "building index..." << endl;
+    KmerIndex queryIndex(query_seqs, ip.kmer_size, ip.kmer_mismatches, ip.kmer_freq, ip.kmer_window,
+			 ip.n_threads, ip.kmer_canonical);
+    string index_file = ip.output_basename + ".idx";
+    IndexFile::write(index_file, queryIndex);
+    cerr << "wrote " << index_file << endl;
+    return 0;
+  }
+  
   shared_ptr< vector < shared_read_ptr > > read_queue(new vector< shared_read_ptr >());
   shared_ptr< bool > has_data(new bool(true));
   vector<thread> threads;
   shared_ptr< int > counter(new int(0));
   shared_ptr< int > workCounter(new int(0));
   shared_ptr< int > alnCounter(new int(0));
-  vector< shared_read_ptr > query_seqs = import_fasta(ip.query_path);
   shared_ptr< vector<alignment_report> > queryHits(new vector<alignment_report>());
   shared_ptr<MutableAlignment> read_ptr;
   shared_ptr<InputParser> reader;
@@ -184,14 +237,43 @@ int main(int argc, char * argv []) {
   //KmerIndex queryIndex(query_seqs, ip.kmer_size, ip.kmer_mismatches, ip.kmer_freq);  
   //shared_ptr<KmerIndex> index_ptr(new KmerIndex(query_seqs, ip.kmer_size, ip.kmer_mismatches, ip.kmer_freq));
 
-  
-  vector<shared_ptr<KmerIndex>> index_ptrs;
-  cerr << "building index..." << endl;
-  for(int i = 0; i < ip.n_threads; ++i){
-    shared_ptr<KmerIndex> index_ptr(new KmerIndex(query_seqs, ip.kmer_size, ip.kmer_mismatches, ip.kmer_freq));
-    index_ptrs.push_back(index_ptr);
+  vector< shared_read_ptr > query_seqs;
+  vector< shared_read_ptr > indexed_seqs;
+  // one read-only index shared by all threads
+  index_ptr queryIndex;
+  if(!ip.index_path.empty()){
+    // a saved index covers every query seq, queries that can not reach
+    // the minimum score are passed over by the aligner's prefilter
+    cerr << "mapping index..." << endl;
+    IndexFile indexFile(ip.index_path);
+    query_seqs = indexFile.sequences();
+    indexed_seqs = query_seqs;
+    queryIndex = indexFile.kmer_index(ip.kmer_freq);
+    ip.kmer_size = indexFile.kmer_size();
+    ip.kmer_mismatches = indexFile.mismatches();
+    ip.kmer_window = indexFile.window();
+    ip.kmer_canonical = indexFile.canonical();
+  }
+  else{
+    query_seqs = import_fasta(ip.query_path);
+    // queries too short to ever reach the minimum score are not indexed,
+    // they still go in the report header
+    for(auto & query : query_seqs){
+      if(max_alignment_score(ip.align_params, query->get_sequence().size(), 0) < ip.align_params.min_aln_score){
+	cerr << "skipping query " << query->get_read_id() << ", it can not reach the minimum alignment score" << endl;
+	continue;
+      }
+      indexed_seqs.push_back(query);
+    }
+    cerr << "building index..." << endl;
+    queryIndex = index_ptr(new KmerIndex(indexed_seqs, ip.kmer_size, ip.kmer_mismatches, ip.kmer_freq,
+					 ip.kmer_window, ip.n_threads, ip.kmer_canonical));
   }
 
+  // probe encodings and query profiles, shared by all threads
+  probe_set_ptr probeSet(new ProbeSet(indexed_seqs, ip.align_params));
+  // exact matching of the probes ahead of the aligner, shared by all threads
+  exact_matcher_ptr exactMatcher(new ExactMatcher(*probeSet, ip.align_params));
   
   auto time_start = chrono::system_clock::now();
   //string out_file = get_report_filename("./", ip.read_path, "_alignments.sam");
@@ -203,7 +285,7 @@ int main(int argc, char * argv []) {
   //////////////////////  
   for(int i = 0; i < ip.n_threads; ++i){
     threads.push_back( thread(consumer, ip, read_queue,
-			      index_ptrs[i], reporter, queryHits,
+			      queryIndex, probeSet, exactMatcher, reporter, queryHits,
 			      has_data, counter, workCounter, alnCounter) );
   }
   
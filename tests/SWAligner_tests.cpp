@@ -18,6 +18,11 @@
 #include "alignment_report.hpp"
 #include "alignment_parameters.hpp"
 #include "sw_aligner.hpp"
+#include "kmer_index.hpp"
+#include "input_parameters.hpp"
+#include "align_primers.hpp"
+#include "exact_matcher.hpp"
+#include "index_file.hpp"
 #include "io_lib_wrapper/mutable_alignment.hpp"
 #include "fastq_reader_wrapper.hpp"
 #include "universal_sequence.hpp"
@@ -59,11 +64,11 @@ TEST_CASE( "Testing exact match", "[sw_aligner]" ) {
   alignment_report aln = alignments->at(0);
   REQUIRE(aln.reference_start == 4);
   REQUIRE(aln.reference_end == 12);
-  REQUIRE(aln.cigar == "9M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "9M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 9);
   REQUIRE(aln.aln_score == 9);
-  REQUIRE(aln.cigar_values == "MMMMMMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMMMMMM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
@@ -87,11 +92,11 @@ TEST_CASE( "Testing deletion, insertion, and mismatch ", "[sw_aligner]" ) {
   alignment_report aln = alignments->at(0);
   REQUIRE(aln.reference_start == 5);
   REQUIRE(aln.reference_end == 20);
-  REQUIRE(aln.cigar == "4M1X2M1D4M1I4M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "4M1X2M1D4M1I4M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 16);
   REQUIRE(aln.aln_score == 6);
-  REQUIRE(aln.cigar_values == "MMMMXMMDMMMMIMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMXMMDMMMMIMMMM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
@@ -117,11 +122,11 @@ TEST_CASE( "Testing affine deletion penalities", "[sw_aligner]" ) {
   alignment_report aln = alignments->at(0);
   REQUIRE(aln.reference_start == 1);
   REQUIRE(aln.reference_end == 14);
-  REQUIRE(aln.cigar == "4M2D8M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "4M2D8M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 12);
   REQUIRE(aln.aln_score == 9);
-  REQUIRE(aln.cigar_values == "MMMMDDMMMMMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMDDMMMMMMMM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
@@ -146,11 +151,11 @@ TEST_CASE( "Testing affine insertion penalities", "[sw_aligner]" ) {
   alignment_report aln = alignments->at(0);
   REQUIRE(aln.reference_start == 1);
   REQUIRE(aln.reference_end == 12);
-  REQUIRE(aln.cigar == "4M1I8M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "4M1I8M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 13);
   REQUIRE(aln.aln_score == 10);
-  REQUIRE(aln.cigar_values == "MMMMIMMMMMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMIMMMMMMMM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
@@ -174,11 +179,11 @@ TEST_CASE( "Testing - strand alignment", "[sw_aligner]" ) {
   alignment_report aln = alignments->at(0);
   REQUIRE(aln.reference_start == 1);
   REQUIRE(aln.reference_end == 7);
-  REQUIRE(aln.cigar == "7M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "7M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 7);
   REQUIRE(aln.aln_score == 7);
-  REQUIRE(aln.cigar_values == "MMMMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMMMM");
   REQUIRE(aln.strand == "-");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
@@ -203,11 +208,11 @@ TEST_CASE( "Testing +/- strand, multi alignments", "[sw_aligner]" ) {
   alignment_report aln = alignments->at(0);
   REQUIRE(aln.reference_start == 12);
   REQUIRE(aln.reference_end == 18);
-  REQUIRE(aln.cigar == "7M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "7M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 7);
   REQUIRE(aln.aln_score == 7);
-  REQUIRE(aln.cigar_values == "MMMMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMMMM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");   
   REQUIRE(aln.query_name == "test_barcode");
@@ -215,17 +220,1073 @@ TEST_CASE( "Testing +/- strand, multi alignments", "[sw_aligner]" ) {
   aln = alignments->at(1);
   REQUIRE(aln.reference_start == 1);
   REQUIRE(aln.reference_end == 7);
-  REQUIRE(aln.cigar == "7M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "7M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 7);
   REQUIRE(aln.aln_score == 7);
-  REQUIRE(aln.cigar_values == "MMMMMMM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMMMM");
   REQUIRE(aln.strand == "-");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
 
 }
 
+void require_same_alignments(shared_ptr< vector<alignment_report> > expected,
+			     shared_ptr< vector<alignment_report> > observed){
+  REQUIRE(observed->size() == expected->size());
+  for(int i = 0; i < expected->size(); ++i){
+    alignment_report exp = expected->at(i);
+    alignment_report obs = observed->at(i);
+    REQUIRE(obs.reference_start == exp.reference_start);
+    REQUIRE(obs.reference_end == exp.reference_end);
+    REQUIRE(obs.query_start == exp.query_start);
+    REQUIRE(obs.query_end == exp.query_end);
+    REQUIRE(obs.cigar_ops == exp.cigar_ops);
+    REQUIRE(obs.aln_score == exp.aln_score);
+    REQUIRE(obs.edit_distance == exp.edit_distance);
+    REQUIRE(obs.strand == exp.strand);
+  }
+}
+
+string random_sequence(int length, const string & alphabet){
+  string sequence;
+  for(int i = 0; i < length; ++i){
+    sequence += alphabet[rand() % alphabet.size()];
+  }
+  return sequence;
+}
+
+// plants planted_str, the sequence of probe or a copy of it with errors,
+// on a random strand of a read between random flanks and returns the
+// read. The candidates of index are those of expected, if given, and
+// with find an exact probe is among them on its strand, seeded on the
+// diagonal it was planted at.
+string require_planted_probe(const KmerIndex & index, const KmerIndex * expected,
+			     shared_ptr<MutableAlignment> probe, const string & planted_str, bool find){
+  char strand = rand() % 2 == 0 ? '+' : '-';
+  string prefix = random_sequence(rand() % 60, "ACGTN");
+  string suffix = random_sequence(rand() % 60, "ACGT");
+  string read_str = prefix + (strand == '+' ? planted_str : reverse_complement(planted_str)) + suffix;
+  // the planted probe starts at this read position on its own strand
+  int diagonal = strand == '+' ? prefix.size() : suffix.size();
+  vector< indexType > candidates = index.filter_by_kmers(read_str, false);
+  if(expected != nullptr){
+    vector< indexType > expected_candidates = expected->filter_by_kmers(read_str, false);
+    REQUIRE(candidates.size() == expected_candidates.size());
+    for(int c = 0; c < candidates.size(); ++c){
+      REQUIRE(get<0>(candidates[c])->get_read_id() == get<0>(expected_candidates[c])->get_read_id());
+      REQUIRE(get<1>(candidates[c]) == get<1>(expected_candidates[c]));
+      REQUIRE(get<2>(candidates[c]) == get<2>(expected_candidates[c]));
+      REQUIRE(get<3>(candidates[c]) == get<3>(expected_candidates[c]));
+    }
+  }
+  if(find){
+    bool found = false;
+    for(auto & candidate : candidates){
+      if(get<0>(candidate)->get_read_id() == probe->get_read_id() and get<1>(candidate) == strand){
+	found = true;
+	REQUIRE(get<2>(candidate).count(diagonal) == 1);
+	REQUIRE(get<3>(candidate) == 0);
+      }
+    }
+    REQUIRE(found);
+  }
+  return read_str;
+}
+
+TEST_CASE( "Testing SIMD kernel against scalar scoring", "[sw_aligner]" ) {
+  srand(42);
+  for(int trial = 0; trial < 300; ++trial){
+    alignment_parameters settings;
+    settings.min_aln_score = 4 + trial % 12;
+    if(trial % 3 == 1){
+      settings.insertion_open = -2;
+      settings.deletion_extend = -3;
+    }
+    bool debug = false;
+    bool global_alignment = (trial % 5 == 4);
+    string barcode_str = random_sequence(3 + rand() % 60, "ACGT");
+    string read_str = random_sequence(rand() % 40, "ACGTN");
+    string planted = barcode_str;
+    for(int i = 0; i < planted.size(); ++i){
+      if(rand() % 10 == 0){
+	planted[i] = "ACGT"[rand() % 4];
+      }
+    }
+    read_str += planted + random_sequence(1 + rand() % 200, "ACGT");
+    shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+    shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+
+    SWAligner scalar_aligner(settings, debug);
+    scalar_aligner.use_simd(false);
+    scalar_aligner.align(barcode, read, global_alignment, expected);
+    SWAligner simd_aligner(settings, debug);
+    simd_aligner.align(barcode, read, global_alignment, observed);
+
+    require_same_alignments(expected, observed);
+  }
+}
+
+TEST_CASE( "Testing lane width promotion", "[sw_aligner]" ) {
+  srand(23);
+  // scores that fit 8 bits, need 16 bits and need 32 bits
+  for(int match : {1, 4, 700}){
+    alignment_parameters settings;
+    settings.match = match;
+    settings.min_aln_score = 10 * match;
+    bool debug = false;
+    for(int trial = 0; trial < 30; ++trial){
+      bool global_alignment = (trial % 3 == 2);
+      string barcode_str = random_sequence(20 + rand() % 50, "ACGT");
+      string read_str = random_sequence(rand() % 60, "ACGT") + barcode_str + random_sequence(rand() % 60, "ACGT");
+      shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+      shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+      shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+      shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+      SWAligner scalar_aligner(settings, debug);
+      scalar_aligner.use_simd(false);
+      scalar_aligner.align(barcode, read, global_alignment, expected);
+      SWAligner simd_aligner(settings, debug);
+      simd_aligner.align(barcode, read, global_alignment, observed);
+      require_same_alignments(expected, observed);
+      REQUIRE(observed->size() > 0);
+
+      PreparedProbe probe(barcode, settings);
+      PreparedRead prepared_read(read);
+      vector< const PreparedRead * > batch(1, &prepared_read);
+      set<int> no_seeds;
+      vector< const set<int> * > diagonals(1, &no_seeds);
+      for(string strand : {"+", "-"}){
+	shared_ptr< vector<alignment_report> > single(new vector<alignment_report>());
+	vector< shared_ptr< vector<alignment_report> > > batched(1, shared_ptr< vector<alignment_report> >(new vector<alignment_report>()));
+	scalar_aligner.align_strand(prepared_read, probe, global_alignment, single, strand);
+	simd_aligner.align_batch(batch, diagonals, probe, global_alignment, batched, strand);
+	require_same_alignments(single, batched[0]);
+      }
+    }
+  }
+}
+
+TEST_CASE( "Testing prepared probe alignment", "[sw_aligner]" ) {
+  srand(7);
+  alignment_parameters default_settings;
+  default_settings.min_aln_score = 10;
+  bool debug = false;
+  bool global_alignment = false;
+  SWAligner aligner(default_settings, debug);
+  for(int trial = 0; trial < 50; ++trial){
+    string barcode_str = random_sequence(12 + rand() % 40, "ACGT");
+    string read_str = random_sequence(rand() % 50, "ACGTNa") + barcode_str
+      + random_sequence(rand() % 50, "ACGT") + reverse_complement(barcode_str);
+    shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    PreparedProbe probe(barcode, default_settings);
+    for(string strand : {"+", "-"}){
+      shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+      shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+      aligner.align_strand(read, barcode, global_alignment, expected, strand, barcode_str.size());
+      aligner.align_strand(read, probe, global_alignment, observed, strand);
+      require_same_alignments(expected, observed);
+      REQUIRE(observed->size() > 0);
+      REQUIRE(observed->at(0).reference_name == "test_barcode");
+      REQUIRE(observed->at(0).query_name == "test_read");
+    }
+  }
+}
+
+TEST_CASE( "Testing batched alignment against single reads", "[sw_aligner]" ) {
+  srand(11);
+  for(int trial = 0; trial < 20; ++trial){
+    alignment_parameters settings;
+    settings.min_aln_score = 8 + trial % 6;
+    bool debug = false;
+    bool global_alignment = (trial % 4 == 3);
+    string barcode_str = random_sequence(15 + rand() % 25, "ACGT");
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    PreparedProbe probe(barcode, settings);
+    vector< PreparedRead > reads;
+    for(int r = 0; r < 40; ++r){
+      string read_str = random_sequence(rand() % 80, "ACGTN");
+      // plant the probe, with a few errors, in about half of the reads
+      if(rand() % 2 == 0){
+	string planted = (rand() % 2 == 0) ? barcode_str : reverse_complement(barcode_str);
+	for(int i = 0; i < planted.size(); ++i){
+	  if(rand() % 12 == 0){
+	    planted[i] = "ACGT"[rand() % 4];
+	  }
+	}
+	read_str += planted + random_sequence(rand() % 80, "ACGT");
+      }
+      reads.push_back(PreparedRead(shared_ptr<MutableAlignment>(new MutableAlignment("test_read", read_str))));
+    }
+    vector< const PreparedRead * > batch;
+    set<int> no_seeds;
+    vector< const set<int> * > diagonals(reads.size(), &no_seeds);
+    for(auto & read : reads){
+      batch.push_back(&read);
+    }
+    SWAligner single_aligner(settings, debug);
+    SWAligner batch_aligner(settings, debug);
+    for(string strand : {"+", "-"}){
+      vector< shared_ptr< vector<alignment_report> > > observed;
+      for(int r = 0; r < reads.size(); ++r){
+	observed.push_back(shared_ptr< vector<alignment_report> >(new vector<alignment_report>()));
+      }
+      batch_aligner.align_batch(batch, diagonals, probe, global_alignment, observed, strand);
+      for(int r = 0; r < reads.size(); ++r){
+	shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+	single_aligner.align_strand(reads[r], probe, global_alignment, expected, strand);
+	require_same_alignments(expected, observed[r]);
+      }
+    }
+  }
+}
+
+TEST_CASE( "Testing seed window alignment", "[sw_aligner]" ) {
+  srand(31);
+  alignment_parameters default_settings;
+  default_settings.min_aln_score = 20;
+  bool debug = false;
+  bool global_alignment = false;
+  int kmer_size = 10;
+  SWAligner full_aligner(default_settings, debug);
+  SWAligner window_aligner(default_settings, debug);
+  window_aligner.set_band_width(16);
+  for(int trial = 0; trial < 20; ++trial){
+    string barcode_str = random_sequence(25 + rand() % 20, "ACGT");
+    string planted = (trial % 2 == 0) ? barcode_str : reverse_complement(barcode_str);
+    planted[rand() % planted.size()] = 'A';
+    string read_str = random_sequence(rand() % 3000, "ACGT") + planted + random_sequence(rand() % 3000, "ACGT");
+    shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    PreparedProbe probe(barcode, default_settings);
+    KmerIndex index(vector< shared_ptr<MutableAlignment> >(1, barcode), kmer_size, 0, 0.5);
+    vector< indexType > candidates = index.filter_by_kmers(read_str, false);
+    REQUIRE(candidates.size() > 0);
+    for(auto & candidate : candidates){
+      string strand(1, get<1>(candidate));
+      REQUIRE(get<2>(candidate).size() > 0);
+      shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+      shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+      full_aligner.align_strand(read, probe, global_alignment, expected, strand);
+      window_aligner.align_strand(read, probe, global_alignment, observed, strand, get<2>(candidate));
+      require_same_alignments(expected, observed);
+      REQUIRE(observed->size() > 0);
+    }
+  }
+  // the two halves of a probe in separate windows score alike, the
+  // tie goes to the one a full read would report
+  for(int trial = 0; trial < 20; ++trial){
+    string left = random_sequence(25, "ACGT");
+    string right = random_sequence(25, "ACGT");
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", left + right));
+    PreparedProbe probe(barcode, default_settings);
+    string read_str = random_sequence(100, "ACGT") + right + random_sequence(275, "ACGT") + left + random_sequence(100, "ACGT");
+    shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+    set<int> diagonals = {100 - (int) left.size(), 400};
+    shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+    shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+    full_aligner.align_strand(read, probe, global_alignment, expected, "+");
+    window_aligner.align_strand(read, probe, global_alignment, observed, "+", diagonals);
+    require_same_alignments(expected, observed);
+    REQUIRE(observed->size() > 0);
+  }
+}
+
+TEST_CASE( "Testing shared kmer index", "[kmer_index]" ) {
+  srand(53);
+  int kmer_size = 8;
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 30; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(20 + rand() % 20, "ACGT"))));
+  }
+  vector< string > reads;
+  for(int r = 0; r < 200; ++r){
+    string barcode_str = barcodes[rand() % barcodes.size()]->get_sequence();
+    if(rand() % 2 == 0){
+      barcode_str = reverse_complement(barcode_str);
+    }
+    reads.push_back(random_sequence(rand() % 100, "ACGTN") + barcode_str + random_sequence(rand() % 100, "ACGT"));
+  }
+  const KmerIndex index(barcodes, kmer_size, 0, 0.5);
+  // reusing a context across reads gives the same hits as a fresh one
+  vector< vector< indexType > > expected;
+  for(auto & read_str : reads){
+    expected.push_back(index.filter_by_kmers(read_str, false));
+  }
+  int n_threads = 4;
+  vector< vector< indexType > > observed(reads.size());
+  vector< thread > threads;
+  for(int t = 0; t < n_threads; ++t){
+    threads.push_back(thread([&, t](){
+	  KmerSearchContext context;
+	  for(int r = t; r < reads.size(); r += n_threads){
+	    observed[r] = index.filter_by_kmers(reads[r], false, context);
+	  }
+	}));
+  }
+  for(auto & worker : threads){
+    worker.join();
+  }
+  for(int r = 0; r < reads.size(); ++r){
+    REQUIRE(observed[r].size() == expected[r].size());
+    REQUIRE(observed[r].size() > 0);
+    for(int c = 0; c < expected[r].size(); ++c){
+      REQUIRE(get<0>(observed[r][c]) == get<0>(expected[r][c]));
+      REQUIRE(get<1>(observed[r][c]) == get<1>(expected[r][c]));
+      REQUIRE(get<2>(observed[r][c]) == get<2>(expected[r][c]));
+    }
+  }
+}
+
+TEST_CASE( "Testing kmer index postings", "[kmer_index]" ) {
+  srand(79);
+  int kmer_size = 9;
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 50; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(20 + rand() % 40, "ACGT"))));
+  }
+  // every kmer, and minimizers of windows of 8 kmers
+  for(int window : {1, 8}){
+    const KmerIndex index(barcodes, kmer_size, 0, 0.5, window);
+    for(int r = 0; r < 200; ++r){
+      shared_ptr<MutableAlignment> barcode = barcodes[rand() % barcodes.size()];
+      require_planted_probe(index, nullptr, barcode, barcode->get_sequence(), true);
+    }
+  }
+  // the kmers of a probe past the last posting position are not
+  // indexed, nor counted as edits
+  string long_str = random_sequence(MAX_POSTING_POSITION + 5000, "ACGT");
+  shared_ptr<MutableAlignment> long_barcode(new MutableAlignment("long_barcode", long_str));
+  const KmerIndex long_index(vector< shared_ptr<MutableAlignment> >(1, long_barcode), kmer_size, 0, 0.5);
+  bool found = false;
+  for(auto & candidate : long_index.filter_by_kmers(long_str, false)){
+    if(get<1>(candidate) == '+'){
+      found = true;
+      REQUIRE(get<3>(candidate) == 0);
+    }
+  }
+  REQUIRE(found);
+}
+
+TEST_CASE( "Testing seed edits of minimizers", "[kmer_index]" ) {
+  srand(113);
+  // a substitution costs no more than the cheapest edit, so the bound is
+  // tight on substitution only alignments
+  alignment_parameters aln_settings;
+  aln_settings.mismatch = 0;
+  aln_settings.insertion_open = -1;
+  aln_settings.insertion_extend = -1;
+  aln_settings.deletion_open = -1;
+  aln_settings.deletion_extend = -1;
+  int kmer_size = 13;
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 30; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(200, "ACGT"))));
+  }
+  for(int window : {1, 5, 20, 40}){
+    const KmerIndex index(barcodes, kmer_size, 0, 0.5, window);
+    for(int r = 0; r < 100; ++r){
+      int b = rand() % barcodes.size();
+      // substitutions closer than a window leave exact stretches that
+      // can share no minimizer with the probe
+      string planted = barcodes[b]->get_sequence();
+      int substitutions = 0;
+      for(int i = rand() % 30; i < planted.size(); i += 17 + rand() % 14){
+	planted[i] = planted[i] == 'A' ? 'C' : 'A';
+	++substitutions;
+      }
+      char strand = rand() % 2 == 0 ? '+' : '-';
+      string read_str = random_sequence(rand() % 40, "ACGT") + (strand == '+' ? planted : reverse_complement(planted))
+	+ random_sequence(rand() % 40, "ACGT");
+      int planted_score = (planted.size() - substitutions) * aln_settings.match + substitutions * aln_settings.mismatch;
+      // the bound never falls below the planted alignment
+      for(auto & candidate : index.filter_by_kmers(read_str, false)){
+	if(get<0>(candidate) == barcodes[b] and get<1>(candidate) == strand){
+	  REQUIRE(candidate_score_bound(aln_settings, candidate) >= planted_score);
+	}
+      }
+    }
+  }
+  // mismatch tolerant kmers still index only the probe minimizers: two
+  // substitutions in a sampled kmer leave the kmers it stands for
+  // uncovered
+  vector< shared_ptr<MutableAlignment> > long_barcodes;
+  for(int i = 0; i < 30; ++i){
+    long_barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(300, "ACGT"))));
+  }
+  for(int window : {4, 30}){
+    const KmerIndex index(long_barcodes, 8, 1, 0.5, window);
+    for(int r = 0; r < 1000; ++r){
+      int b = rand() % long_barcodes.size();
+      string planted = long_barcodes[b]->get_sequence();
+      int first = rand() % planted.size();
+      int second = (first + 1 + rand() % 7) % planted.size();
+      for(int i : {first, second}){
+	planted[i] = planted[i] == 'A' ? 'C' : 'A';
+      }
+      char strand = rand() % 2 == 0 ? '+' : '-';
+      string read_str = random_sequence(rand() % 40, "ACGT") + (strand == '+' ? planted : reverse_complement(planted))
+	+ random_sequence(rand() % 40, "ACGT");
+      int planted_score = (planted.size() - 2) * aln_settings.match + 2 * aln_settings.mismatch;
+      for(auto & candidate : index.filter_by_kmers(read_str, false)){
+	if(get<0>(candidate) == long_barcodes[b] and get<1>(candidate) == strand){
+	  REQUIRE(get<3>(candidate) <= 2);
+	  REQUIRE(candidate_score_bound(aln_settings, candidate) >= planted_score);
+	}
+      }
+    }
+  }
+}
+
+TEST_CASE( "Testing mismatch tolerant kmers", "[kmer_index]" ) {
+  srand(83);
+  int kmer_size = 8;
+  for(int trial = 0; trial < 20; ++trial){
+    string barcode_str = random_sequence(40, "ACGT");
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    // one substitution every kmer_size bases leaves no exact kmer
+    string planted = barcode_str;
+    for(int i = trial % kmer_size; i < planted.size(); i += kmer_size){
+      planted[i] = planted[i] == 'A' ? 'C' : 'A';
+    }
+    char strand = trial % 2 == 0 ? '+' : '-';
+    string prefix = random_sequence(rand() % 30, "ACGT");
+    string suffix = random_sequence(rand() % 30, "ACGT");
+    string read_str = prefix + (strand == '+' ? planted : reverse_complement(planted)) + suffix;
+    int diagonal = strand == '+' ? prefix.size() : suffix.size();
+    KmerIndex exact_index(vector< shared_ptr<MutableAlignment> >(1, barcode), kmer_size, 0, 0.5);
+    for(auto & candidate : exact_index.filter_by_kmers(read_str, false)){
+      REQUIRE(get<2>(candidate).count(diagonal) == 0);
+    }
+    for(int window : {1, 4}){
+      KmerIndex index(vector< shared_ptr<MutableAlignment> >(1, barcode), kmer_size, 1, 0.5, window);
+      bool found = false;
+      for(auto & candidate : index.filter_by_kmers(read_str, false)){
+	if(get<1>(candidate) == strand){
+	  found = true;
+	  REQUIRE(get<2>(candidate).count(diagonal) == 1);
+	}
+      }
+      REQUIRE(found);
+    }
+  }
+}
+
+TEST_CASE( "Testing blocked bloom filter", "[kmer_index]" ) {
+  srand(97);
+  vector< uint32_t > keys;
+  for(int i = 0; i < 5000; ++i){
+    keys.push_back((uint32_t(rand()) << 16) ^ uint32_t(rand()));
+  }
+  BlockedBloomFilter filter(keys.begin(), keys.end());
+  for(uint32_t key : keys){
+    REQUIRE(filter.contains(key));
+  }
+  sort(keys.begin(), keys.end());
+  int false_positives = 0;
+  int tested = 0;
+  for(uint32_t key = 0; tested < 100000; key += 7919){
+    if(!binary_search(keys.begin(), keys.end(), key)){
+      ++tested;
+      false_positives += filter.contains(key);
+    }
+  }
+  REQUIRE(false_positives < tested / 50);
+  REQUIRE(!BlockedBloomFilter().contains(0));
+
+  // a read the filter turns away has no candidates
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 20; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("test_barcode_" + to_string(i),
+									 random_sequence(30, "ACGT"))));
+  }
+  for(int window : {1, 6}){
+    KmerIndex index(barcodes, 10, 0, 0.5, window);
+    int rejected = 0;
+    for(int trial = 0; trial < 200; ++trial){
+      string read_str = random_sequence(100, "ACGTN");
+      if(trial % 2 == 0){
+	string barcode_str = barcodes[rand() % barcodes.size()]->get_sequence();
+	read_str.replace(rand() % 60, barcode_str.size(),
+			 trial % 4 == 0 ? barcode_str : reverse_complement(barcode_str));
+	REQUIRE(index.may_match(read_str));
+      }
+      if(!index.may_match(read_str)){
+	++rejected;
+	REQUIRE(index.filter_by_kmers(read_str, false).empty());
+      }
+    }
+    REQUIRE(rejected > 50);
+  }
+}
+
+TEST_CASE( "Testing saved index file", "[kmer_index]" ) {
+  srand(101);
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 40; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(20 + rand() % 40, "ACGTN"))));
+  }
+  string path = "test_index.idx";
+  for(int window : {1, 5}){
+    const KmerIndex index(barcodes, 9, window == 1 ? 1 : 0, 0.5, window);
+    IndexFile::write(path, index);
+    IndexFile index_file(path);
+    REQUIRE(index_file.kmer_size() == 9);
+    REQUIRE(index_file.mismatches() == (window == 1 ? 1 : 0));
+    REQUIRE(index_file.window() == window);
+    const vector< shared_ptr<MutableAlignment> > & sequences = index_file.sequences();
+    REQUIRE(sequences.size() == barcodes.size());
+    for(int i = 0; i < barcodes.size(); ++i){
+      REQUIRE(sequences[i]->get_read_id() == barcodes[i]->get_read_id());
+      REQUIRE(sequences[i]->get_sequence() == barcodes[i]->get_sequence());
+    }
+    shared_ptr< const KmerIndex > mapped = index_file.kmer_index(0.5);
+    // the mapped index finds the same query seqs as the one it was saved from
+    for(int r = 0; r < 200; ++r){
+      shared_ptr<MutableAlignment> barcode = barcodes[rand() % barcodes.size()];
+      string read_str = require_planted_probe(*mapped, &index, barcode, barcode->get_sequence(), false);
+      REQUIRE(mapped->may_match(read_str) == index.may_match(read_str));
+    }
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE( "Testing parallel index build", "[kmer_index]" ) {
+  srand(103);
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 300; ++i){
+    // repeats put many postings under the same kmers
+    string barcode_str = i % 10 == 0 ? string(40, 'A') : random_sequence(20 + rand() % 60, "ACGTN");
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), barcode_str)));
+  }
+  // the saved index holds every array of the kmer index
+  auto saved = [](const KmerIndex & index){
+    string path = "test_parallel_index.idx";
+    IndexFile::write(path, index);
+    ifstream in(path, ios::binary);
+    string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    remove(path.c_str());
+    return bytes;
+  };
+  for(int window : {1, 4}){
+    string serial = saved(KmerIndex(barcodes, 7, window == 1 ? 1 : 0, 0.5, window, 1));
+    for(int threads : {2, 5, 16}){
+      REQUIRE(saved(KmerIndex(barcodes, 7, window == 1 ? 1 : 0, 0.5, window, threads)) == serial);
+    }
+  }
+  // more threads than probes
+  vector< shared_ptr<MutableAlignment> > few(barcodes.begin(), barcodes.begin() + 3);
+  REQUIRE(saved(KmerIndex(few, 7, 0, 0.5, 1, 8)) == saved(KmerIndex(few, 7, 0, 0.5, 1, 1)));
+}
+
+TEST_CASE( "Testing long kmers", "[kmer_index]" ) {
+  srand(107);
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 40; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(40 + rand() % 40, "ACGT"))));
+  }
+  for(int kmer_size : {17, 24, 32}){
+    for(int window : {1, 6}){
+      const KmerIndex index(barcodes, kmer_size, kmer_size == 24 ? 1 : 0, 0.5, window);
+      string path = "test_long_kmers.idx";
+      IndexFile::write(path, index);
+      IndexFile index_file(path);
+      shared_ptr< const KmerIndex > mapped = index_file.kmer_index(0.5);
+      // the 64 bit keys are saved and mapped as they are
+      for(int r = 0; r < 100; ++r){
+	shared_ptr<MutableAlignment> barcode = barcodes[rand() % barcodes.size()];
+	require_planted_probe(*mapped, &index, barcode, barcode->get_sequence(), true);
+      }
+      remove(path.c_str());
+      // kmers that differ only in their first base are told apart
+      string read_str = barcodes[0]->get_sequence().substr(0, kmer_size);
+      read_str[0] = read_str[0] == 'A' ? 'C' : 'A';
+      if(kmer_size != 24){
+	for(auto & candidate : index.filter_by_kmers(read_str, false)){
+	  REQUIRE(get<0>(candidate) != barcodes[0]);
+	}
+      }
+    }
+  }
+}
+
+TEST_CASE( "Testing canonical kmers", "[kmer_index]" ) {
+  srand(109);
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 40; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(30 + rand() % 40, "ACGTN"))));
+  }
+  // a probe that is its own reverse complement, and one with a
+  // palindromic kmer
+  barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("palindrome", "ACGTTGCAATTGCAACGT")));
+  barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("palindromic_kmer", "TTTTTTTTGAATTCAAAAAAAA")));
+  for(int kmer_size : {8, 9, 20}){
+    for(int mismatches : {0, 1}){
+      // every kmer looked up, the same query seqs on the same strands
+      const KmerIndex index(barcodes, kmer_size, mismatches, 0.5);
+      const KmerIndex canonical(barcodes, kmer_size, mismatches, 0.5, 1, 1, true);
+      for(int r = 0; r < 200; ++r){
+	shared_ptr<MutableAlignment> barcode = barcodes[rand() % barcodes.size()];
+	string planted_str = barcode->get_sequence();
+	if(mismatches > 0){
+	  planted_str[rand() % planted_str.size()] = "ACGT"[rand() % 4];
+	}
+	string read_str = require_planted_probe(canonical, &index, barcode, planted_str, false);
+	// the filters differ in their false positives only
+	REQUIRE((canonical.may_match(read_str) or index.filter_by_kmers(read_str, false).empty()));
+      }
+    }
+  }
+  // minimizers sample both strands alike, planted probes are found on
+  // their strand and diagonal from a saved index about half the size
+  string path = "test_canonical_kmers.idx";
+  IndexFile::write(path, KmerIndex(barcodes, 12, 0, 0.5, 5));
+  struct stat plain_stat;
+  stat(path.c_str(), &plain_stat);
+  IndexFile::write(path, KmerIndex(barcodes, 12, 0, 0.5, 5, 1, true));
+  struct stat canonical_stat;
+  stat(path.c_str(), &canonical_stat);
+  REQUIRE(canonical_stat.st_size < plain_stat.st_size);
+  IndexFile index_file(path);
+  REQUIRE(index_file.canonical());
+  shared_ptr< const KmerIndex > mapped = index_file.kmer_index(0.5);
+  for(int r = 0; r < 200; ++r){
+    shared_ptr<MutableAlignment> barcode = barcodes[rand() % (barcodes.size() - 2)];
+    if(barcode->get_sequence().find('N') == string::npos){
+      require_planted_probe(*mapped, nullptr, barcode, barcode->get_sequence(), true);
+    }
+  }
+  remove(path.c_str());
+}
+
+TEST_CASE( "Testing rolling kmer encoding", "[kmer_index]" ) {
+  srand(73);
+  for(int kmer_size : {1, 5, 11, 16, 17, 25, 32}){
+    RollingKmer rolling(kmer_size);
+    WideRollingKmer wide_rolling(kmer_size);
+    string sequence = random_sequence(300, "ACGTACGTACGTACGTACGTN");
+    for(int pos = 0; pos < sequence.size(); ++pos){
+      bool full = wide_rolling.push(sequence[pos]);
+      REQUIRE(rolling.push(sequence[pos]) == full);
+      int start = pos - kmer_size + 1;
+      string kmer = start < 0 ? "" : sequence.substr(start, kmer_size);
+      REQUIRE(full == (start >= 0 and kmer.find('N') == string::npos));
+      if(!full){
+	continue;
+      }
+      uint64_t forward = 0;
+      uint64_t reverse = 0;
+      string kmer_rc = reverse_complement(kmer);
+      for(int i = 0; i < kmer_size; ++i){
+	forward = forward * 4 + base_code(kmer[i]);
+	reverse = reverse * 4 + base_code(kmer_rc[i]);
+      }
+      REQUIRE(wide_rolling.forward() == forward);
+      REQUIRE(wide_rolling.reverse() == reverse);
+      REQUIRE(reverse_complement_code(forward, kmer_size) == reverse);
+      if(kmer_size <= MAX_NARROW_KMER_SIZE){
+	REQUIRE(rolling.forward() == forward);
+	REQUIRE(rolling.reverse() == reverse);
+	REQUIRE(reverse_complement_code(rolling.forward(), kmer_size) == rolling.reverse());
+      }
+    }
+  }
+  // an N in the read is not read as an A
+  shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", "AAAAAAAAAAAAAAAAAAAA"));
+  KmerIndex index(vector< shared_ptr<MutableAlignment> >(1, barcode), 8, 0, 0.5);
+  REQUIRE(index.filter_by_kmers("CGTCGTCGTNNNNNNNNNNNNNNNNNNNNCGTCGT", false).size() == 0);
+  REQUIRE(index.filter_by_kmers("CGTCGTCGTAAAAAAAAAAAAAAAAAAAACGTCGT", false).size() > 0);
+}
+
+TEST_CASE( "Testing exact match fast path", "[exact_matcher]" ) {
+  srand(71);
+  bool debug = false;
+  alignment_parameters settings;
+  settings.min_aln_score = 12;
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 30; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(8 + rand() % 30, "ACGT"))));
+  }
+  // a probe inside another one, a repeated probe and one with an N
+  barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("inner", barcodes[0]->get_sequence().substr(2, 14))));
+  barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("repeat", "ACACACACACACACAC")));
+  barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("with_n", "ACGTACGTNACGTACGT")));
+  ProbeSet probe_set(barcodes, settings);
+  ExactMatcher matcher(probe_set, settings);
+  SWAligner aligner(settings, debug);
+  set< pair<int, char> > all_strands;
+  for(int p = 0; p < probe_set.size(); ++p){
+    all_strands.insert(make_pair(p, '+'));
+    all_strands.insert(make_pair(p, '-'));
+  }
+  int exact = 0;
+  for(int r = 0; r < 100; ++r){
+    string read_str = random_sequence(rand() % 30, "ACGTN");
+    for(int b = 0; b < 3; ++b){
+      string planted = barcodes[rand() % barcodes.size()]->get_sequence();
+      if(rand() % 2 == 0){
+	planted = reverse_complement(planted);
+      }
+      if(rand() % 3 == 0){
+	planted[rand() % planted.size()] = 'N';
+      }
+      read_str += planted + random_sequence(rand() % 30, "ACGTN");
+    }
+    PreparedRead read(shared_ptr<MutableAlignment>(new MutableAlignment("test_read", read_str)));
+    vector< alignment_report > hits;
+    set< pair<int, char> > matched;
+    matcher.find_matches(read, all_strands, hits, matched);
+    REQUIRE(hits.size() == matched.size());
+    // only the candidates of the kmer index are reported
+    set< pair<int, char> > some_strands;
+    for(auto & probe_strand : all_strands){
+      if(rand() % 2 == 0){
+	some_strands.insert(probe_strand);
+      }
+    }
+    vector< alignment_report > some_hits;
+    set< pair<int, char> > some_matched;
+    matcher.find_matches(read, some_strands, some_hits, some_matched);
+    set< pair<int, char> > expected_matched;
+    for(auto & probe_strand : matched){
+      if(some_strands.count(probe_strand)){
+	expected_matched.insert(probe_strand);
+      }
+    }
+    REQUIRE(some_matched == expected_matched);
+    REQUIRE(some_hits.size() == some_matched.size());
+    exact += hits.size();
+    // the aligner finds the exact match, and nothing else, for every
+    // probe and strand matched, and no whole probe match for the others
+    for(int p = 0; p < probe_set.size(); ++p){
+      const PreparedProbe & probe = probe_set.at(p);
+      for(string strand : {"+", "-"}){
+	shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+	aligner.align_strand(read, probe, false, expected, strand);
+	shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+	for(auto & hit : hits){
+	  if(hit.reference_name == probe.name() and hit.strand == strand){
+	    observed->push_back(hit);
+	  }
+	}
+	if(matched.count(make_pair(p, strand[0]))){
+	  REQUIRE(observed->size() == 1);
+	  require_same_alignments(expected, observed);
+	}
+	else{
+	  REQUIRE(observed->size() == 0);
+	  for(auto & alignment : *expected){
+	    REQUIRE((alignment.edit_distance > 0 or alignment.query_end - alignment.query_start + 1 < probe.sequence().size()
+		     or probe.sequence().find('N') != string::npos));
+	  }
+	}
+      }
+    }
+  }
+  REQUIRE(exact > 0);
+}
+
+TEST_CASE( "Testing bounded probe evaluation", "[align_primers]" ) {
+  srand(67);
+  bool debug = false;
+  input_parameters ip;
+  ip.align_params.min_aln_score = 15;
+  vector< shared_ptr<MutableAlignment> > barcodes;
+  for(int i = 0; i < 40; ++i){
+    barcodes.push_back(shared_ptr<MutableAlignment>(new MutableAlignment("barcode_" + to_string(i), random_sequence(20 + rand() % 30, "ACGT"))));
+  }
+  ProbeSet probe_set(barcodes, ip.align_params);
+  const KmerIndex index(barcodes, 8, 0, 0.5);
+  SWAligner aligner(ip.align_params, debug);
+  vector< PreparedRead > reads;
+  vector< vector< indexType > > candidates;
+  for(int r = 0; r < 60; ++r){
+    string read_str;
+    // several barcodes per read, some with errors, so they compete for the report
+    for(int b = 0; b < 4; ++b){
+      string planted = barcodes[rand() % barcodes.size()]->get_sequence();
+      if(rand() % 2 == 0){
+	planted = reverse_complement(planted);
+      }
+      for(int i = 0; i < planted.size(); ++i){
+	if(rand() % 10 == 0){
+	  planted[i] = "ACGT"[rand() % 4];
+	}
+      }
+      read_str += random_sequence(rand() % 40, "ACGT") + planted;
+    }
+    reads.push_back(PreparedRead(shared_ptr<MutableAlignment>(new MutableAlignment("test_read", read_str))));
+    candidates.push_back(index.filter_by_kmers(read_str, true));
+  }
+  int pruned = 0;
+  for(int max_report : {1, 2, 3}){
+    vector< shared_ptr< vector<alignment_report> > > batched;
+    for(int r = 0; r < reads.size(); ++r){
+      batched.push_back(shared_ptr< vector<alignment_report> >(new vector<alignment_report>()));
+    }
+    ip.max_report = max_report;
+    align_primers_batch(ip, aligner, reads, candidates, probe_set, batched);
+    for(int r = 0; r < reads.size(); ++r){
+      // no candidate scores above its bound
+      for(auto & candidate : candidates[r]){
+	shared_ptr< vector<alignment_report> > found(new vector<alignment_report>());
+	string strand(1, get<1>(candidate));
+	aligner.align_strand(reads[r], probe_set.find(get<0>(candidate)), false, found, strand, get<2>(candidate));
+	for(auto & alignment : *found){
+	  REQUIRE(alignment.aln_score <= candidate_score_bound(ip.align_params, candidate));
+	}
+      }
+      // the reported alignments are those of evaluating every candidate
+      ip.max_report = 0;
+      shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+      align_primers(ip, aligner, reads[r].read(), candidates[r], probe_set, expected, -1);
+      ip.max_report = max_report;
+      shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+      align_primers(ip, aligner, reads[r].read(), candidates[r], probe_set, observed, -1);
+      REQUIRE(observed->size() <= expected->size());
+      if(observed->size() < expected->size()){
+	pruned++;
+      }
+      expected->resize(min<int>(expected->size(), max_report));
+      shared_ptr< vector<alignment_report> > observed_top(new vector<alignment_report>(*observed));
+      observed_top->resize(min<int>(observed->size(), max_report));
+      require_same_alignments(expected, observed_top);
+      require_same_alignments(observed, batched[r]);
+    }
+  }
+  REQUIRE(pruned > 0);
+}
+
+TEST_CASE( "Testing x-drop seed windows", "[sw_aligner]" ) {
+  srand(71);
+  alignment_parameters default_settings;
+  default_settings.min_aln_score = 20;
+  bool debug = false;
+  bool global_alignment = false;
+  int kmer_size = 10;
+  for(int trial = 0; trial < 20; ++trial){
+    string barcode_str = random_sequence(25 + rand() % 20, "ACGT");
+    string planted = (trial % 2 == 0) ? barcode_str : reverse_complement(barcode_str);
+    planted[rand() % planted.size()] = 'A';
+    // runs of N keep the local scores at zero
+    string read_str = random_sequence(rand() % 2000, "ACGT") + string(rand() % 200, 'N') + planted
+      + string(rand() % 200, 'N') + random_sequence(rand() % 2000, "ACGT");
+    shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    PreparedProbe probe(barcode, default_settings);
+    KmerIndex index(vector< shared_ptr<MutableAlignment> >(1, barcode), kmer_size, 0, 0.5);
+    vector< indexType > candidates = index.filter_by_kmers(read_str, false);
+    REQUIRE(candidates.size() > 0);
+    int traced = 0;
+    for(bool simd : {true, false}){
+      SWAligner full_aligner(default_settings, debug);
+      SWAligner xdrop_aligner(default_settings, debug);
+      full_aligner.use_simd(simd);
+      xdrop_aligner.use_simd(simd);
+      xdrop_aligner.set_band_width(200);
+      xdrop_aligner.set_x_drop(12);
+      for(auto & candidate : candidates){
+	string strand(1, get<1>(candidate));
+	shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+	shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+	full_aligner.align_strand(read, probe, global_alignment, expected, strand);
+	xdrop_aligner.align_strand(read, probe, global_alignment, observed, strand, get<2>(candidate));
+	require_same_alignments(expected, observed);
+	traced += observed->size();
+      }
+    }
+    REQUIRE(traced > 0);
+  }
+}
+
+TEST_CASE( "Testing checkpointed traceback", "[sw_aligner]" ) {
+  srand(67);
+  bool debug = false;
+  for(int trial = 0; trial < 24; ++trial){
+    alignment_parameters settings;
+    settings.min_aln_score = 20;
+    // wide scores promote the lanes while blocks are rescored
+    settings.match = (trial % 3 == 2) ? 4 : 1;
+    bool global_alignment = (trial % 4 == 3);
+    string barcode_str = random_sequence(30 + rand() % 120, "ACGT");
+    string read_str;
+    for(int copy = 0; copy < 1 + rand() % 4; ++copy){
+      string planted = (rand() % 2 == 0) ? barcode_str : reverse_complement(barcode_str);
+      for(int i = 0; i < planted.size(); ++i){
+	if(rand() % 15 == 0){
+	  planted[i] = "ACGT"[rand() % 4];
+	}
+      }
+      read_str += random_sequence(rand() % 400, "ACGT") + planted;
+    }
+    read_str += random_sequence(rand() % 100, "ACGT");
+    shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    PreparedProbe probe(barcode, settings);
+    int traced = 0;
+    for(bool simd : {true, false}){
+      SWAligner full_aligner(settings, debug);
+      SWAligner checkpoint_aligner(settings, debug);
+      full_aligner.use_simd(simd);
+      checkpoint_aligner.use_simd(simd);
+      checkpoint_aligner.set_trace_cell_limit(trial % 2 == 0 ? 1 : 4000);
+      for(string strand : {"+", "-"}){
+	shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+	shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+	full_aligner.align_strand(read, probe, global_alignment, expected, strand);
+	checkpoint_aligner.align_strand(read, probe, global_alignment, observed, strand);
+	require_same_alignments(expected, observed);
+	traced += expected->size();
+      }
+    }
+    REQUIRE((global_alignment or traced > 0));
+  }
+}
+
+TEST_CASE( "Testing packed traceback and cigar operations", "[sw_aligner]" ) {
+  srand(61);
+  AlignmentWorkspace workspace;
+  int rows = 7;
+  int cols = 301;
+  TracebackMatrix traceback = workspace.traceback_matrix(rows, cols);
+  vector< int > expected(rows * cols, 0);
+  for(int i = 1; i < rows; ++i){
+    for(int j = 1; j < cols; ++j){
+      expected[i * cols + j] = rand() % 4 - 1;
+      traceback.set(i, j, expected[i * cols + j]);
+    }
+  }
+  for(int i = 0; i < rows; ++i){
+    for(int j = 0; j < cols; ++j){
+      REQUIRE(traceback.get(i, j) == expected[i * cols + j]);
+    }
+  }
+  vector< uint32_t > cigar;
+  push_cigar_op(cigar, CIGAR_MATCH, 4);
+  push_cigar_op(cigar, CIGAR_MISMATCH);
+  push_cigar_op(cigar, CIGAR_MATCH);
+  push_cigar_op(cigar, CIGAR_MATCH);
+  push_cigar_op(cigar, CIGAR_DELETION);
+  push_cigar_op(cigar, CIGAR_INSERTION, 2);
+  REQUIRE(cigar_string(cigar) == "4M1X2M1D2I");
+  REQUIRE(expanded_cigar(cigar) == "MMMMXMMDII");
+  add_soft_clips(cigar, 3, 0);
+  add_soft_clips(cigar, 2, 5);
+  REQUIRE(cigar_string(cigar) == "5S4M1X2M1D2I5S");
+}
+
+TEST_CASE( "Testing maxima filtering", "[sw_aligner]" ) {
+  srand(59);
+  // the pairwise filter the sweep replaced
+  auto pairwise_filter = [](const vector< maxima_coords > & maxima, int query_len){
+    vector< maxima_coords > filtered_maxima;
+    for(int i = 0; i < maxima.size(); ++i){
+      bool keep = true;
+      for(int j = 0; j < maxima.size(); ++j){
+	if( i != j){
+	  int dist = abs( (maxima[i].ref_pos - maxima[j].ref_pos) );
+	  if( dist < ( query_len * 1.25 ) ){
+	    if( maxima[j].aln_score > maxima[i].aln_score ){
+	      keep = false;
+	    }
+	    else if( maxima[j].aln_score == maxima[i].aln_score ){
+	      if( maxima[j].query_pos > maxima[i].query_pos ){
+		keep = false;
+	      }
+	      else if( maxima[j].query_pos == maxima[i].query_pos ){
+		if(maxima[j].ref_pos < maxima[i].ref_pos){
+		  keep = false;
+		}
+	      }
+	    }
+	  }
+	}
+      }
+      if(keep){
+	filtered_maxima.push_back(maxima[i]);
+      }
+    }
+    return filtered_maxima;
+  };
+  for(int trial = 0; trial < 500; ++trial){
+    int query_len = 1 + rand() % 40;
+    vector< maxima_coords > maxima(rand() % 200);
+    // few distinct values so ties are common, not always sorted by ref_pos
+    int ref_pos = 0;
+    for(auto & coords : maxima){
+      ref_pos += (trial % 3 == 0) ? rand() % 20 - 5 : rand() % 10;
+      coords.ref_pos = ref_pos;
+      coords.query_pos = rand() % 4;
+      coords.aln_score = 10 + rand() % 3;
+    }
+    vector< maxima_coords > expected = pairwise_filter(maxima, query_len);
+    vector< maxima_coords > observed = filter_overlapping_maxima(maxima, query_len * 1.25);
+    REQUIRE(observed.size() == expected.size());
+    for(int i = 0; i < expected.size(); ++i){
+      REQUIRE(observed[i].ref_pos == expected[i].ref_pos);
+      REQUIRE(observed[i].query_pos == expected[i].query_pos);
+      REQUIRE(observed[i].aln_score == expected[i].aln_score);
+    }
+  }
+}
+
+TEST_CASE( "Testing edit distance prefilter", "[sw_aligner]" ) {
+  srand(43);
+  bool debug = false;
+  bool global_alignment = false;
+  for(int trial = 0; trial < 60; ++trial){
+    alignment_parameters settings;
+    settings.min_aln_score = 10 + rand() % 30;
+    settings.match = 1 + trial % 3;
+    // probes past 64bp take the multi-word path
+    string barcode_str = random_sequence(20 + rand() % 120, "ACGT");
+    shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", barcode_str));
+    PreparedProbe probe(barcode, settings);
+    SWAligner aligner(settings, debug);
+    for(int r = 0; r < 10; ++r){
+      string planted = barcode_str.substr(rand() % 10);
+      for(int i = 0; i < planted.size(); ++i){
+	int edit = rand() % 10;
+	if(edit == 0){
+	  planted[i] = "ACGT"[rand() % 4];
+	}
+	else if(edit == 1){
+	  planted.erase(i, 1);
+	}
+	else if(edit == 2){
+	  planted.insert(i, 1, "ACGT"[rand() % 4]);
+	}
+      }
+      string read_str = random_sequence(rand() % 60, "ACGTN") + planted + random_sequence(rand() % 60, "ACGT");
+      shared_ptr<MutableAlignment> read(new MutableAlignment("test_read", read_str));
+      for(string strand : {"+", "-"}){
+	// every reported alignment has to pass the filter
+	shared_ptr< vector<alignment_report> > expected(new vector<alignment_report>());
+	shared_ptr< vector<alignment_report> > observed(new vector<alignment_report>());
+	aligner.align_strand(read, barcode, global_alignment, expected, strand, barcode_str.size());
+	aligner.align_strand(read, probe, global_alignment, observed, strand);
+	require_same_alignments(expected, observed);
+	string sequence = strand == "+" ? read_str : reverse_complement(read_str);
+	if(expected->size() > 0){
+	  REQUIRE(probe.may_align(sequence));
+	}
+      }
+    }
+  }
+  // a selective budget rejects unrelated reads
+  alignment_parameters settings;
+  settings.min_aln_score = 50;
+  shared_ptr<MutableAlignment> barcode(new MutableAlignment("test_barcode", random_sequence(60, "ACGT")));
+  PreparedProbe probe(barcode, settings);
+  REQUIRE(max_edit_distance(settings, 60) == 10);
+  for(int r = 0; r < 20; ++r){
+    REQUIRE(!probe.may_align(random_sequence(150, "ACGTN")));
+  }
+}
+
 /*
 TEST_CASE( "Testing global alignment", "[sw_aligner]" ) {
   alignment_parameters default_settings;
@@ -248,11 +1309,11 @@ TEST_CASE( "Testing global alignment", "[sw_aligner]" ) {
   
   REQUIRE(aln.reference_start == 8);
   REQUIRE(aln.reference_end == 15);
-  REQUIRE(aln.cigar == "6M1D1M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "6M1D1M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 7);
   REQUIRE(aln.aln_score == 6);
-  REQUIRE(aln.cigar_values == "MMMMMMDM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMMMDM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   
@@ -281,11 +1342,11 @@ TEST_CASE( "Testing soft-clipped alignment", "[sw_aligner]" ) {
     
   REQUIRE(aln.reference_start == 7);
   REQUIRE(aln.reference_end == 15);
-  REQUIRE(aln.cigar == "6M1D1M");
+  REQUIRE(cigar_string(aln.cigar_ops) == "6M1D1M");
   REQUIRE(aln.query_start == 1);
   REQUIRE(aln.query_end == 7);
   REQUIRE(aln.aln_score == 6);
-  REQUIRE(aln.cigar_values == "MMMMMMDM");
+  REQUIRE(expanded_cigar(aln.cigar_ops) == "MMMMMMDM");
   REQUIRE(aln.strand == "+");
   REQUIRE(aln.reference_name == "test_read");
   REQUIRE(aln.query_name == "test_barcode");   